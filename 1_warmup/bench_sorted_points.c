@@ -0,0 +1,502 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "point.h"
+#include "sorted_points.h"
+
+/* Measures the throughput and latency percentiles of each sorted_points.h
+ * operation, for every backend, dataset size, point distribution and
+ * operation mix requested. Each run first fills an empty object with <size>
+ * points (reported once per size, as mix "fill"), then performs a number of
+ * operations of the mix on it, and finally deletes duplicates once. The
+ * default sizes are 1e3 to 1e8. The point operations of
+ * point.h are measured separately. Results are printed as CSV or JSON.
+ *
+ * usage: bench_sorted_points [-b backends] [-n sizes] [-d distributions]
+ *                            [-m mixes] [-k ops per mix] [-t seconds]
+ *                            [-o csv|json]
+ *
+ * Lists are comma separated, and sizes can be written as e.g. 1e6. A phase
+ * that does not finish within the time limit is cut short and reported as
+ * truncated. */
+
+#define NR_SAMPLES	(64 * 1024)
+#define MAX_LIST	16
+
+enum op { OP_ADD, OP_FIRST, OP_LAST, OP_INDEX, OP_DUPS, NR_OPS };
+
+static const char *op_names[NR_OPS] = {
+	"add_point", "remove_first", "remove_last", "remove_by_index",
+	"delete_duplicates",
+};
+
+/* per operation results of one phase. latencies are kept for a uniform
+ * random sample of the operations (reservoir sampling). */
+struct op_stats {
+	long ops;
+	double secs;
+	long nr_samples;
+	double samples[NR_SAMPLES];
+};
+
+/* percent of operations of each kind in a mix, in op order */
+struct mix {
+	const char *name;
+	int percent[NR_OPS];
+};
+
+static const struct mix mixes[] = {
+	/* priority queue: add and take the nearest point */
+	{ "fifo", { 50, 50, 0, 0, 0 } },
+	/* double-ended queue */
+	{ "deque", { 50, 25, 25, 0, 0 } },
+	/* as many adds as removes, so the dataset stays around its size */
+	{ "random", { 50, 20, 20, 10, 0 } },
+	/* remove every point, from alternate ends */
+	{ "drain", { 0, 50, 50, 0, 0 } },
+};
+#define NR_MIXES (int)(sizeof(mixes) / sizeof(mixes[0]))
+
+static const struct {
+	const char *name;
+	enum sp_backend backend;
+} backends[] = {
+	{ "list", SP_LIST },
+	{ "lazy", SP_LIST_LAZY },
+	{ "heap", SP_MINMAX_HEAP },
+};
+#define NR_BACKENDS (int)(sizeof(backends) / sizeof(backends[0]))
+
+static const char *dists[] = { "uniform", "clustered", "ties" };
+#define NR_DISTS (int)(sizeof(dists) / sizeof(dists[0]))
+
+static struct op_stats stats[NR_OPS];
+static double time_limit = 2.0;
+static long mix_ops = 100000;
+static int json;
+static int nr_rows;
+
+static inline double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+uniform(double lo, double hi)
+{
+	return lo + (hi - lo) * (rand() / ((double)RAND_MAX + 1));
+}
+
+/* generate a point of distribution dist for a dataset of size points */
+static void
+gen_point(int dist, long size, struct point *p)
+{
+	static const int triples[12][2] = {
+		{ 3, 4 }, { 4, 3 }, { -3, 4 }, { -4, 3 }, { 3, -4 }, { 4, -3 },
+		{ -3, -4 }, { -4, -3 }, { 5, 0 }, { 0, 5 }, { -5, 0 }, { 0, -5 },
+	};
+	double cx, cy;
+	long k;
+	int t;
+
+	switch (dist) {
+	case 0:
+		point_set(p, uniform(-1e6, 1e6), uniform(-1e6, 1e6));
+		break;
+	case 1:
+		/* 16 clusters, roughly normal around their centers */
+		k = rand() % 16;
+		cx = (k % 4) * 2.5e5 - 3.75e5;
+		cy = (k / 4) * 2.5e5 - 3.75e5;
+		point_set(p, cx + uniform(-1e3, 1e3) + uniform(-1e3, 1e3),
+			  cy + uniform(-1e3, 1e3) + uniform(-1e3, 1e3));
+		break;
+	default:
+		/* integer points at exactly the same distance 5k from the
+		 * origin, about 100 points per distance */
+		k = 1 + rand() % (size / 100 + 1);
+		t = rand() % 12;
+		point_set(p, (double)(triples[t][0] * k),
+			  (double)(triples[t][1] * k));
+		break;
+	}
+}
+
+static inline void
+add_sample(struct op_stats *s, double secs)
+{
+	long i;
+
+	if (s->nr_samples < NR_SAMPLES) {
+		s->samples[s->nr_samples++] = secs;
+	} else {
+		i = ((long)rand() * ((long)RAND_MAX + 1) + rand()) % s->ops;
+		if (i < NR_SAMPLES)
+			s->samples[i] = secs;
+	}
+}
+
+static inline void
+record(enum op op, double secs)
+{
+	stats[op].ops++;
+	stats[op].secs += secs;
+	add_sample(&stats[op], secs);
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double d1 = *(const double *)a;
+	double d2 = *(const double *)b;
+
+	return (d1 > d2) - (d1 < d2);
+}
+
+static double
+percentile(const struct op_stats *s, double pct)
+{
+	long i = (long)(pct / 100.0 * (s->nr_samples - 1) + 0.5);
+
+	return s->samples[i] * 1e9;
+}
+
+static void
+print_header(void)
+{
+	if (json)
+		printf("[\n");
+	else
+		printf("backend,distribution,size,mix,op,ops,seconds,"
+		       "mops_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,"
+		       "truncated\n");
+}
+
+static void
+print_footer(void)
+{
+	if (json)
+		printf("\n]\n");
+}
+
+/* print and reset the statistics of one operation */
+static void
+print_row(const char *backend, const char *dist, long size, const char *mix,
+	  const char *op, struct op_stats *s, int truncated)
+{
+	qsort(s->samples, s->nr_samples, sizeof(double), cmp_double);
+	if (json) {
+		printf("%s  {\"backend\": \"%s\", \"distribution\": \"%s\", "
+		       "\"size\": %ld, \"mix\": \"%s\", \"op\": \"%s\", "
+		       "\"ops\": %ld, \"seconds\": %.6f, "
+		       "\"mops_per_sec\": %.4f, \"p50_ns\": %.0f, "
+		       "\"p90_ns\": %.0f, \"p99_ns\": %.0f, "
+		       "\"p999_ns\": %.0f, \"max_ns\": %.0f, "
+		       "\"truncated\": %s}", nr_rows ? ",\n" : "",
+		       backend, dist, size, mix, op, s->ops, s->secs,
+		       s->ops / s->secs / 1e6, percentile(s, 50),
+		       percentile(s, 90), percentile(s, 99),
+		       percentile(s, 99.9), percentile(s, 100),
+		       truncated ? "true" : "false");
+	} else {
+		printf("%s,%s,%ld,%s,%s,%ld,%.6f,%.4f,%.0f,%.0f,%.0f,%.0f,"
+		       "%.0f,%d\n", backend, dist, size, mix, op, s->ops,
+		       s->secs, s->ops / s->secs / 1e6, percentile(s, 50),
+		       percentile(s, 90), percentile(s, 99),
+		       percentile(s, 99.9), percentile(s, 100), truncated);
+	}
+	nr_rows++;
+	s->ops = 0;
+	s->secs = 0;
+	s->nr_samples = 0;
+	fflush(stdout);
+}
+
+/* drop the statistics of a phase that is not reported */
+static void
+clear_stats(void)
+{
+	int op;
+
+	for (op = 0; op < NR_OPS; op++) {
+		stats[op].ops = 0;
+		stats[op].secs = 0;
+		stats[op].nr_samples = 0;
+	}
+}
+
+/* print the statistics of every operation that ran in a phase */
+static void
+report(const char *backend, const char *dist, long size, const char *mix,
+       int truncated)
+{
+	int op;
+
+	for (op = 0; op < NR_OPS; op++) {
+		if (stats[op].ops > 0)
+			print_row(backend, dist, size, mix, op_names[op],
+				  &stats[op], truncated);
+	}
+}
+
+/* run one operation on sp, which holds n points of a dataset of size points,
+ * returning the change in the number of points */
+static long
+run_op(struct sorted_points *sp, enum op op, long size, long n, int dist)
+{
+	struct point p;
+	double start;
+	long ret;
+	int index = 0;
+
+	if (op == OP_ADD)
+		gen_point(dist, size, &p);
+	else if (op == OP_INDEX)
+		index = n > 0 ? rand() % n : 0;
+	start = now();
+	switch (op) {
+	case OP_ADD:
+		ret = sp_add_point(sp, point_X(&p), point_Y(&p));
+		assert(ret);
+		break;
+	case OP_FIRST:
+		ret = -sp_remove_first(sp, &p);
+		break;
+	case OP_LAST:
+		ret = -sp_remove_last(sp, &p);
+		break;
+	case OP_INDEX:
+		ret = -sp_remove_by_index(sp, index, &p);
+		break;
+	default:
+		ret = -sp_delete_duplicates(sp);
+		break;
+	}
+	record(op, now() - start);
+	return ret;
+}
+
+static enum op
+pick_op(const struct mix *mix, long size)
+{
+	int r = rand() % 100;
+	int op;
+
+	/* keep the dataset close to its size */
+	if (size == 0 && mix->percent[OP_ADD] > 0)
+		return OP_ADD;
+	for (op = 0; op < NR_OPS; op++) {
+		if (r < mix->percent[op])
+			return op;
+		r -= mix->percent[op];
+	}
+	return OP_FIRST;
+}
+
+/* the fill is only reported if show_fill, since it is the same for every
+ * mix */
+static void
+run(int b, int dist, long size, const struct mix *mix, int show_fill)
+{
+	struct sorted_points *sp;
+	double deadline;
+	long n = 0;
+	long ii;
+	int truncated = 0;
+
+	srand(1);
+	sp = sp_init_backend(backends[b].backend);
+	assert(sp);
+
+	deadline = now() + time_limit;
+	while (n < size) {
+		n += run_op(sp, OP_ADD, size, n, dist);
+		if ((n & 1023) == 0 && now() > deadline) {
+			truncated = 1;
+			break;
+		}
+	}
+	if (show_fill)
+		report(backends[b].name, dists[dist], size, "fill",
+		       truncated);
+	else
+		clear_stats();
+	if (truncated)
+		goto out;
+
+	deadline = now() + time_limit;
+	for (ii = 0; ii < mix_ops; ii++) {
+		/* a mix without adds ends when the dataset is empty */
+		if (n == 0 && mix->percent[OP_ADD] == 0)
+			break;
+		n += run_op(sp, pick_op(mix, n), size, n, dist);
+		if ((ii & 1023) == 0 && now() > deadline) {
+			truncated = 1;
+			break;
+		}
+	}
+	n += run_op(sp, OP_DUPS, size, n, dist);
+	report(backends[b].name, dists[dist], size, mix->name, truncated);
+out:
+	sp_destroy(sp);
+}
+
+/* the point operations, timed in batches since each is only a few ns */
+static void
+run_point_ops(void)
+{
+	static const char *names[] = { "point_translate", "point_distance",
+				       "point_compare" };
+	static struct op_stats s;
+	static const int BATCH = 1024;
+	struct point pts[BATCH];
+	volatile double sink = 0;
+	double start, secs;
+	int op, i;
+
+	for (i = 0; i < BATCH; i++)
+		gen_point(0, BATCH, &pts[i]);
+	for (op = 0; op < 3; op++) {
+		while (s.secs < time_limit / 4) {
+			start = now();
+			for (i = 0; i < BATCH; i++) {
+				if (op == 0)
+					point_translate(&pts[i], 1e-9, -1e-9);
+				else if (op == 1)
+					sink += point_distance(&pts[i],
+						&pts[(i + 1) % BATCH]);
+				else
+					sink += point_compare(&pts[i],
+						&pts[(i + 1) % BATCH]);
+			}
+			secs = now() - start;
+			s.ops += BATCH;
+			s.secs += secs;
+			/* one sample per batch, at the per op average */
+			add_sample(&s, secs / BATCH);
+		}
+		print_row("point", "uniform", BATCH, "batch", names[op], &s, 0);
+	}
+}
+
+/* split a comma separated list, returning the number of items */
+static int
+split_list(char *arg, char **items)
+{
+	int n = 0;
+	char *tok;
+
+	for (tok = strtok(arg, ","); tok != NULL && n < MAX_LIST;
+	     tok = strtok(NULL, ","))
+		items[n++] = tok;
+	return n;
+}
+
+/* returns a bitmap of the items in arg found in names, all when arg is NULL */
+static int
+parse_names(char *arg, const char **names, int nr_names)
+{
+	char *items[MAX_LIST];
+	int map = 0;
+	int n, i, j;
+
+	if (arg == NULL)
+		return (1 << nr_names) - 1;
+	n = split_list(arg, items);
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < nr_names; j++) {
+			if (strcmp(items[i], names[j]) == 0)
+				break;
+		}
+		if (j == nr_names) {
+			fprintf(stderr, "unknown name: %s\n", items[i]);
+			exit(1);
+		}
+		map |= 1 << j;
+	}
+	return map;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *backend_names[NR_BACKENDS], *mix_names[NR_MIXES];
+	char *backend_arg = NULL, *dist_arg = NULL, *mix_arg = NULL;
+	char default_sizes[] = "1e3,1e4,1e5,1e6,1e7,1e8";
+	char *size_arg = default_sizes;
+	char *items[MAX_LIST];
+	long sizes[MAX_LIST];
+	int backend_map, dist_map, mix_map;
+	int nr_sizes, opt, b, d, m, i, first;
+
+	while ((opt = getopt(argc, argv, "b:n:d:m:k:t:o:")) != -1) {
+		switch (opt) {
+		case 'b':
+			backend_arg = optarg;
+			break;
+		case 'n':
+			size_arg = optarg;
+			break;
+		case 'd':
+			dist_arg = optarg;
+			break;
+		case 'm':
+			mix_arg = optarg;
+			break;
+		case 'k':
+			mix_ops = (long)strtod(optarg, NULL);
+			break;
+		case 't':
+			time_limit = strtod(optarg, NULL);
+			break;
+		case 'o':
+			json = (strcmp(optarg, "json") == 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b backends] [-n sizes] "
+				"[-d distributions] [-m mixes] "
+				"[-k ops per mix] [-t seconds] [-o csv|json]\n",
+				argv[0]);
+			exit(1);
+		}
+	}
+	for (b = 0; b < NR_BACKENDS; b++)
+		backend_names[b] = backends[b].name;
+	for (m = 0; m < NR_MIXES; m++)
+		mix_names[m] = mixes[m].name;
+	backend_map = parse_names(backend_arg, backend_names, NR_BACKENDS);
+	dist_map = parse_names(dist_arg, dists, NR_DISTS);
+	mix_map = parse_names(mix_arg, mix_names, NR_MIXES);
+	nr_sizes = split_list(size_arg, items);
+	for (i = 0; i < nr_sizes; i++)
+		sizes[i] = (long)strtod(items[i], NULL);
+
+	print_header();
+	run_point_ops();
+	for (b = 0; b < NR_BACKENDS; b++) {
+		if (!(backend_map & (1 << b)))
+			continue;
+		for (d = 0; d < NR_DISTS; d++) {
+			if (!(dist_map & (1 << d)))
+				continue;
+			for (i = 0; i < nr_sizes; i++) {
+				first = 1;
+				for (m = 0; m < NR_MIXES; m++) {
+					if (!(mix_map & (1 << m)))
+						continue;
+					run(b, d, sizes[i], &mixes[m], first);
+					first = 0;
+				}
+			}
+		}
+	}
+	print_footer();
+	return 0;
+}
@@ -0,0 +1,218 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "point.h"
+#include "sorted_points.h"
+#include "sorted_points_mt.h"
+
+/* Compares the lock-free sorted_points_mt against sorted_points protected by a
+ * single mutex. Each thread alternates between adding a random point and
+ * removing the first point, so the number of points stays close to the
+ * prefill. Prints one CSV line per implementation and thread count.
+ *
+ * usage: bench_sorted_points_mt [-t max threads] [-n ops per thread]
+ *                               [-p prefill] */
+
+struct impl {
+	const char *name;
+	void *(*init)(void);
+	void (*destroy)(void *sp);
+	int (*add_point)(void *sp, double x, double y);
+	int (*remove_first)(void *sp, struct point *ret);
+};
+
+/* sorted_points wrapped in a mutex */
+struct locked_sp {
+	pthread_mutex_t lock;
+	struct sorted_points *sp;
+};
+
+static void *
+locked_init(void)
+{
+	struct locked_sp *lsp = malloc(sizeof(struct locked_sp));
+
+	assert(lsp);
+	pthread_mutex_init(&lsp->lock, NULL);
+	lsp->sp = sp_init();
+	assert(lsp->sp);
+	return lsp;
+}
+
+static void
+locked_destroy(void *arg)
+{
+	struct locked_sp *lsp = arg;
+
+	sp_destroy(lsp->sp);
+	pthread_mutex_destroy(&lsp->lock);
+	free(lsp);
+}
+
+static int
+locked_add_point(void *arg, double x, double y)
+{
+	struct locked_sp *lsp = arg;
+	int ret;
+
+	pthread_mutex_lock(&lsp->lock);
+	ret = sp_add_point(lsp->sp, x, y);
+	pthread_mutex_unlock(&lsp->lock);
+	return ret;
+}
+
+static int
+locked_remove_first(void *arg, struct point *p)
+{
+	struct locked_sp *lsp = arg;
+	int ret;
+
+	pthread_mutex_lock(&lsp->lock);
+	ret = sp_remove_first(lsp->sp, p);
+	pthread_mutex_unlock(&lsp->lock);
+	return ret;
+}
+
+static void *
+mt_init(void)
+{
+	struct sorted_points_mt *sp = spmt_init();
+
+	assert(sp);
+	return sp;
+}
+
+static void
+mt_destroy(void *sp)
+{
+	spmt_destroy(sp);
+}
+
+static int
+mt_add_point(void *sp, double x, double y)
+{
+	return spmt_add_point(sp, x, y);
+}
+
+static int
+mt_remove_first(void *sp, struct point *p)
+{
+	return spmt_remove_first(sp, p);
+}
+
+static const struct impl impls[] = {
+	{ "mutex", locked_init, locked_destroy, locked_add_point,
+	  locked_remove_first },
+	{ "lockfree", mt_init, mt_destroy, mt_add_point, mt_remove_first },
+};
+
+static const struct impl *impl;
+static void *bench_sp;
+static long nops;
+static pthread_barrier_t barrier;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+worker(void *arg)
+{
+	unsigned int seed = (unsigned int)(long)arg + 1;
+	struct point p;
+	long ii;
+	int ret;
+
+	pthread_barrier_wait(&barrier);
+	for (ii = 0; ii < nops; ii += 2) {
+		ret = impl->add_point(bench_sp, (double)(rand_r(&seed) % 1000),
+				      (double)(rand_r(&seed) % 1000));
+		assert(ret);
+		impl->remove_first(bench_sp, &p);
+	}
+	pthread_barrier_wait(&barrier);
+	return NULL;
+}
+
+static double
+run(int nthreads, int prefill)
+{
+	pthread_t tids[nthreads];
+	unsigned int seed = 0;
+	double start, end;
+	long i;
+	int ret;
+
+	bench_sp = impl->init();
+	for (i = 0; i < prefill; i++) {
+		ret = impl->add_point(bench_sp, (double)(rand_r(&seed) % 1000),
+				      (double)(rand_r(&seed) % 1000));
+		assert(ret);
+	}
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_create(&tids[i], NULL, worker, (void *)i);
+		assert(!ret);
+	}
+	pthread_barrier_wait(&barrier);
+	start = now();
+	pthread_barrier_wait(&barrier);
+	end = now();
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	pthread_barrier_destroy(&barrier);
+	impl->destroy(bench_sp);
+	return end - start;
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_threads = 8;
+	int prefill = 1000;
+	int nthreads, opt;
+	unsigned int i;
+	double secs;
+
+	nops = 200000;
+	while ((opt = getopt(argc, argv, "t:n:p:")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			nops = atol(optarg);
+			break;
+		case 'p':
+			prefill = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t max threads] "
+				"[-n ops per thread] [-p prefill]\n", argv[0]);
+			exit(1);
+		}
+	}
+	assert(max_threads > 0 && max_threads < SPMT_MAX_THREADS);
+
+	printf("impl,threads,prefill,ops,seconds,mops_per_sec\n");
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		impl = &impls[i];
+		for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+			secs = run(nthreads, prefill);
+			printf("%s,%d,%d,%ld,%.6f,%.3f\n", impl->name,
+			       nthreads, prefill, nops * nthreads, secs,
+			       nops * nthreads / secs / 1e6);
+			fflush(stdout);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,546 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "point.h"
+#include "kdtree.h"
+#include "math.h"
+
+/* number of points held by one leaf bucket */
+#define KD_BUCKET 16
+/* a subtree is rebuilt when one child holds more than this fraction of its
+ * points. small subtrees are left alone, see kd_unbalanced(). */
+#define KD_ALPHA 0.75
+/* longest root to leaf path, which the rebalancing keeps well below */
+#define KD_MAX_DEPTH 128
+
+struct kd_node {
+	int axis;	/* 0 splits on x, 1 splits on y, -1 for a leaf */
+	double split;	/* left subtree <= split <= right subtree */
+	int left;	/* child nodes, or next free node when on free list */
+	int right;
+	int bucket;	/* leaf only: bucket number in kdtree->pts */
+	int count;	/* number of points in this subtree */
+};
+
+struct kdtree {
+	/* node 0 is always the root */
+	struct kd_node *nodes;
+	int nr_nodes;
+	int max_nodes;
+	int free_node;	/* list of released nodes, linked by left */
+
+	/* bucket b holds the points pts[b * KD_BUCKET ...] of one leaf */
+	struct point *pts;
+	int nr_buckets;
+	int max_buckets;
+	int *free_buckets;	/* stack of released buckets */
+	int nr_free_buckets;
+};
+
+/* best matches found so far by a nearest neighbour search, closest first */
+struct kd_best {
+	int k;
+	int found;
+	double *dist;
+	struct point *pts;
+};
+
+static inline double
+kd_coord(const struct point *p, int axis)
+{
+	return axis == 0 ? p->x : p->y;
+}
+
+static inline struct point *
+kd_bucket(const struct kdtree *kd, int bucket)
+{
+	return kd->pts + (long)bucket * KD_BUCKET;
+}
+
+/* returns 1 when a point at distance d1 is ordered before a point at distance
+ * d2. ties are broken by x, then y, as in sorted_points. */
+static inline int
+kd_closer(double d1, const struct point *p1, double d2, const struct point *p2)
+{
+	if (d1 != d2)
+		return d1 < d2;
+	if (p1->x != p2->x)
+		return p1->x < p2->x;
+	return p1->y < p2->y;
+}
+
+/* make sure that nnodes more nodes and nbuckets more buckets can be allocated
+ * without failing. returns 1 on success and 0 when out of memory. */
+static int
+kd_reserve(struct kdtree *kd, int nnodes, int nbuckets)
+{
+	if (kd->nr_nodes + nnodes > kd->max_nodes) {
+		int max = kd->max_nodes * 2;
+		struct kd_node *nodes;
+
+		if (max < kd->nr_nodes + nnodes)
+			max = kd->nr_nodes + nnodes;
+		nodes = realloc(kd->nodes, max * sizeof(struct kd_node));
+		if (nodes == NULL)
+			return 0;
+		kd->nodes = nodes;
+		kd->max_nodes = max;
+	}
+	if (kd->nr_buckets + nbuckets > kd->max_buckets) {
+		int max = kd->max_buckets * 2;
+		struct point *pts;
+		int *free_buckets;
+
+		if (max < kd->nr_buckets + nbuckets)
+			max = kd->nr_buckets + nbuckets;
+		pts = realloc(kd->pts, (long)max * KD_BUCKET *
+			      sizeof(struct point));
+		if (pts == NULL)
+			return 0;
+		kd->pts = pts;
+		free_buckets = realloc(kd->free_buckets, max * sizeof(int));
+		if (free_buckets == NULL)
+			return 0;
+		kd->free_buckets = free_buckets;
+		kd->max_buckets = max;
+	}
+	return 1;
+}
+
+/* the allocators below must be preceded by a successful kd_reserve() */
+static int
+kd_new_node(struct kdtree *kd)
+{
+	int node;
+
+	if (kd->free_node >= 0) {
+		node = kd->free_node;
+		kd->free_node = kd->nodes[node].left;
+		return node;
+	}
+	assert(kd->nr_nodes < kd->max_nodes);
+	return kd->nr_nodes++;
+}
+
+static int
+kd_new_bucket(struct kdtree *kd)
+{
+	if (kd->nr_free_buckets > 0)
+		return kd->free_buckets[--kd->nr_free_buckets];
+	assert(kd->nr_buckets < kd->max_buckets);
+	return kd->nr_buckets++;
+}
+
+/* release all nodes and buckets below node, but not node itself */
+static void
+kd_free_children(struct kdtree *kd, int node)
+{
+	int left, right;
+
+	if (kd->nodes[node].axis < 0)
+		return;
+	left = kd->nodes[node].left;
+	right = kd->nodes[node].right;
+	kd_free_children(kd, left);
+	kd_free_children(kd, right);
+	if (kd->nodes[left].axis < 0)
+		kd->free_buckets[kd->nr_free_buckets++] =
+			kd->nodes[left].bucket;
+	if (kd->nodes[right].axis < 0)
+		kd->free_buckets[kd->nr_free_buckets++] =
+			kd->nodes[right].bucket;
+	kd->nodes[left].left = kd->free_node;
+	kd->nodes[right].left = left;
+	kd->free_node = right;
+}
+
+/* reorder pts so that pts[k] has the k-th smallest coordinate along axis, with
+ * no larger coordinates before it and no smaller ones after it. */
+static void
+kd_select(struct point *pts, int n, int k, int axis)
+{
+	int lo = 0;
+	int hi = n - 1;
+
+	while (lo < hi) {
+		double pivot = kd_coord(&pts[lo + (hi - lo) / 2], axis);
+		int i = lo;
+		int j = hi;
+
+		while (i <= j) {
+			while (kd_coord(&pts[i], axis) < pivot)
+				i++;
+			while (kd_coord(&pts[j], axis) > pivot)
+				j--;
+			if (i <= j) {
+				struct point tmp = pts[i];
+				pts[i] = pts[j];
+				pts[j] = tmp;
+				i++;
+				j--;
+			}
+		}
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+}
+
+/* split along the axis on which the points are spread out the most */
+static int
+kd_split_axis(const struct point *pts, int n)
+{
+	double min_x, max_x, min_y, max_y;
+	int i;
+
+	min_x = max_x = pts[0].x;
+	min_y = max_y = pts[0].y;
+	for (i = 1; i < n; i++) {
+		if (pts[i].x < min_x)
+			min_x = pts[i].x;
+		if (pts[i].x > max_x)
+			max_x = pts[i].x;
+		if (pts[i].y < min_y)
+			min_y = pts[i].y;
+		if (pts[i].y > max_y)
+			max_y = pts[i].y;
+	}
+	return (max_x - min_x >= max_y - min_y) ? 0 : 1;
+}
+
+/* upper bound on the nodes and buckets needed to build a tree of n points.
+ * every leaf created by a split holds at least KD_BUCKET / 2 points. */
+static inline int
+kd_build_buckets(int n)
+{
+	return n / (KD_BUCKET / 2) + 1;
+}
+
+/* build a balanced subtree of the n points in pts, rooted at node. pts is used
+ * as scratch space. the caller reserves the space needed. */
+static void
+kd_build_node(struct kdtree *kd, int node, struct point *pts, int n)
+{
+	int axis, mid, left, right;
+
+	kd->nodes[node].count = n;
+	if (n <= KD_BUCKET) {
+		int bucket = kd_new_bucket(kd);
+
+		if (n > 0)
+			memcpy(kd_bucket(kd, bucket), pts,
+			       n * sizeof(struct point));
+		kd->nodes[node].axis = -1;
+		kd->nodes[node].bucket = bucket;
+		return;
+	}
+	axis = kd_split_axis(pts, n);
+	mid = n / 2;
+	kd_select(pts, n, mid, axis);
+	left = kd_new_node(kd);
+	right = kd_new_node(kd);
+	kd->nodes[node].axis = axis;
+	kd->nodes[node].split = kd_coord(&pts[mid], axis);
+	kd->nodes[node].left = left;
+	kd->nodes[node].right = right;
+	kd_build_node(kd, left, pts, mid);
+	kd_build_node(kd, right, pts + mid, n - mid);
+}
+
+/* copy the points of the subtree rooted at node into pts, returning the number
+ * of points copied. */
+static int
+kd_gather(const struct kdtree *kd, int node, struct point *pts)
+{
+	const struct kd_node *n = &kd->nodes[node];
+
+	if (n->axis < 0) {
+		memcpy(pts, kd_bucket(kd, n->bucket),
+		       n->count * sizeof(struct point));
+		return n->count;
+	}
+	return kd_gather(kd, n->left, pts) +
+		kd_gather(kd, n->right, pts + kd->nodes[n->left].count);
+}
+
+/* rebuild the subtree rooted at node into a balanced one. this is only an
+ * optimization, so the tree is left as is when out of memory. */
+static void
+kd_rebuild(struct kdtree *kd, int node)
+{
+	int n = kd->nodes[node].count;
+	struct point *pts;
+
+	if (!kd_reserve(kd, 2 * kd_build_buckets(n), kd_build_buckets(n)))
+		return;
+	pts = malloc(n * sizeof(struct point));
+	if (pts == NULL)
+		return;
+	kd_gather(kd, node, pts);
+	kd_free_children(kd, node);
+	if (kd->nodes[node].axis < 0)
+		kd->free_buckets[kd->nr_free_buckets++] =
+			kd->nodes[node].bucket;
+	kd_build_node(kd, node, pts, n);
+	free(pts);
+}
+
+static inline int
+kd_unbalanced(const struct kdtree *kd, int node)
+{
+	const struct kd_node *n = &kd->nodes[node];
+	int heavy;
+
+	if (n->axis < 0)
+		return 0;
+	heavy = kd->nodes[n->left].count;
+	if (kd->nodes[n->right].count > heavy)
+		heavy = kd->nodes[n->right].count;
+	return heavy > KD_ALPHA * n->count + KD_BUCKET;
+}
+
+/* split the full leaf node, adding p to one of its halves */
+static void
+kd_split_leaf(struct kdtree *kd, int node, const struct point *p)
+{
+	struct point pts[KD_BUCKET + 1];
+	int bucket = kd->nodes[node].bucket;
+	int n = kd->nodes[node].count;
+
+	assert(n == KD_BUCKET);
+	memcpy(pts, kd_bucket(kd, bucket), n * sizeof(struct point));
+	pts[n++] = *p;
+	kd->free_buckets[kd->nr_free_buckets++] = bucket;
+	kd_build_node(kd, node, pts, n);
+}
+
+static struct kdtree *
+kd_alloc(int n)
+{
+	struct kdtree *kd;
+
+	kd = (struct kdtree *)malloc(sizeof(struct kdtree));
+	if (kd == NULL)
+		return NULL;
+	kd->nodes = NULL;
+	kd->nr_nodes = 0;
+	kd->max_nodes = 0;
+	kd->free_node = -1;
+	kd->pts = NULL;
+	kd->nr_buckets = 0;
+	kd->max_buckets = 0;
+	kd->free_buckets = NULL;
+	kd->nr_free_buckets = 0;
+	if (!kd_reserve(kd, 2 * kd_build_buckets(n), kd_build_buckets(n))) {
+		kd_destroy(kd);
+		return NULL;
+	}
+	kd->nr_nodes = 1;
+	return kd;
+}
+
+struct kdtree *
+kd_init(void)
+{
+	struct kdtree *kd = kd_alloc(0);
+
+	if (kd == NULL)
+		return NULL;
+	kd_build_node(kd, 0, NULL, 0);
+	return kd;
+}
+
+struct kdtree *
+kd_build(const struct point *pts, int n)
+{
+	struct kdtree *kd;
+	struct point *tmp;
+
+	assert(n >= 0);
+	tmp = malloc((n > 0 ? n : 1) * sizeof(struct point));
+	if (tmp == NULL)
+		return NULL;
+	kd = kd_alloc(n);
+	if (kd != NULL) {
+		if (n > 0)
+			memcpy(tmp, pts, n * sizeof(struct point));
+		kd_build_node(kd, 0, tmp, n);
+	}
+	free(tmp);
+	return kd;
+}
+
+void
+kd_destroy(struct kdtree *kd)
+{
+	free(kd->nodes);
+	free(kd->pts);
+	free(kd->free_buckets);
+	free(kd);
+}
+
+int
+kd_size(const struct kdtree *kd)
+{
+	return kd->nodes[0].count;
+}
+
+int
+kd_add_point(struct kdtree *kd, double x, double y)
+{
+	int path[KD_MAX_DEPTH];
+	int depth = 0;
+	int node = 0;
+	int i;
+	struct point p;
+
+	/* a split needs two new nodes and one new bucket */
+	if (!kd_reserve(kd, 2, 1))
+		return 0;
+	point_set(&p, x, y);
+	while (kd->nodes[node].axis >= 0) {
+		if (depth < KD_MAX_DEPTH)
+			path[depth++] = node;
+		kd->nodes[node].count++;
+		if (kd_coord(&p, kd->nodes[node].axis) < kd->nodes[node].split)
+			node = kd->nodes[node].left;
+		else
+			node = kd->nodes[node].right;
+	}
+	if (kd->nodes[node].count < KD_BUCKET) {
+		kd_bucket(kd, kd->nodes[node].bucket)[kd->nodes[node].count++] =
+			p;
+	} else {
+		kd_split_leaf(kd, node, &p);
+	}
+	/* rebuild the topmost subtree that has become lopsided */
+	for (i = 0; i < depth; i++) {
+		if (kd_unbalanced(kd, path[i])) {
+			kd_rebuild(kd, path[i]);
+			break;
+		}
+	}
+	return 1;
+}
+
+/* offer the point p at distance d to the list of best matches */
+static void
+kd_best_add(struct kd_best *best, double d, const struct point *p)
+{
+	int i;
+
+	if (best->found == best->k) {
+		if (!kd_closer(d, p, best->dist[best->k - 1],
+			       &best->pts[best->k - 1]))
+			return;
+		best->found--;
+	}
+	for (i = best->found; i > 0; i--) {
+		if (!kd_closer(d, p, best->dist[i - 1], &best->pts[i - 1]))
+			break;
+		best->dist[i] = best->dist[i - 1];
+		best->pts[i] = best->pts[i - 1];
+	}
+	best->dist[i] = d;
+	best->pts[i] = *p;
+	best->found++;
+}
+
+static void
+kd_nearest_node(const struct kdtree *kd, int node, const struct point *q,
+		struct kd_best *best)
+{
+	const struct kd_node *n = &kd->nodes[node];
+	double diff;
+
+	if (n->axis < 0) {
+		const struct point *pts = kd_bucket(kd, n->bucket);
+		int i;
+
+		for (i = 0; i < n->count; i++)
+			kd_best_add(best, point_distance(q, &pts[i]), &pts[i]);
+		return;
+	}
+	diff = kd_coord(q, n->axis) - n->split;
+	kd_nearest_node(kd, diff < 0 ? n->left : n->right, q, best);
+	/* the other side can only hold a closer point, or an equally close
+	 * point that wins the tie, if the splitting line is close enough */
+	if (best->found < best->k || fabs(diff) <= best->dist[best->k - 1])
+		kd_nearest_node(kd, diff < 0 ? n->right : n->left, q, best);
+}
+
+int
+kd_nearest(const struct kdtree *kd, const struct point *q, struct point *ret)
+{
+	struct kd_best best;
+	double dist;
+
+	best.k = 1;
+	best.found = 0;
+	best.dist = &dist;
+	best.pts = ret;
+	kd_nearest_node(kd, 0, q, &best);
+	return best.found;
+}
+
+int
+kd_nearest_k(const struct kdtree *kd, const struct point *q, int k,
+	     struct point *ret)
+{
+	struct kd_best best;
+
+	if (k <= 0)
+		return 0;
+	best.k = k;
+	best.found = 0;
+	best.dist = malloc(k * sizeof(double));
+	if (best.dist == NULL)
+		return -1;
+	best.pts = ret;
+	kd_nearest_node(kd, 0, q, &best);
+	free(best.dist);
+	return best.found;
+}
+
+static int
+kd_radius_node(const struct kdtree *kd, int node, const struct point *q,
+	       double radius, struct point *ret, int max, int found)
+{
+	const struct kd_node *n = &kd->nodes[node];
+	double diff;
+
+	if (n->axis < 0) {
+		const struct point *pts = kd_bucket(kd, n->bucket);
+		int i;
+
+		for (i = 0; i < n->count; i++) {
+			if (point_distance(q, &pts[i]) <= radius) {
+				if (found < max)
+					ret[found] = pts[i];
+				found++;
+			}
+		}
+		return found;
+	}
+	diff = kd_coord(q, n->axis) - n->split;
+	if (diff <= radius)
+		found = kd_radius_node(kd, n->left, q, radius, ret, max, found);
+	if (-diff <= radius)
+		found = kd_radius_node(kd, n->right, q, radius, ret, max,
+				       found);
+	return found;
+}
+
+int
+kd_radius(const struct kdtree *kd, const struct point *q, double radius,
+	  struct point *ret, int max)
+{
+	if (radius < 0)
+		return 0;
+	return kd_radius_node(kd, 0, q, radius, ret, max, 0);
+}
@@ -0,0 +1,57 @@
+#ifndef _KDTREE_H_
+#define _KDTREE_H_
+#include "point.h"
+
+/* A 2D k-d tree over struct point, used as a spatial companion to
+ * sorted_points. sorted_points orders points by their distance from the
+ * origin, while a kdtree answers "which stored points are closest to (qx, qy)"
+ * for an arbitrary query point. All distances are point_distance() distances.
+ *
+ * Points are kept in bucketed leaves. The buckets of all leaves live in one
+ * contiguous array, so a query scans a few short runs of memory instead of
+ * chasing one pointer per point. */
+
+/* Forward declaration of structure for the function declarations below. */
+struct kdtree;
+
+/* Initialize an empty tree, returning pointer to a new object, or NULL when
+ * out of memory. */
+struct kdtree *kd_init(void);
+
+/* Build a balanced tree from the n points in pts. The points are copied, so
+ * pts can be released after the call. Returns NULL when out of memory. */
+struct kdtree *kd_build(const struct point *pts, int n);
+
+/* Destroy the tree. */
+void kd_destroy(struct kdtree *kd);
+
+/* Return the number of points stored in the tree. */
+int kd_size(const struct kdtree *kd);
+
+/* Add the point x,y to the tree. Return 1 on success and 0 on error (e.g., out
+ * of memory). */
+int kd_add_point(struct kdtree *kd, double x, double y);
+
+/* Note: When several stored points are at the same distance from the query
+ * point, the one with the smaller x coordinate is considered closer, and if the
+ * x coordinates are also the same, the one with the smaller y coordinate. This
+ * matches the tie-breaking rule of sorted_points. */
+
+/* Find the stored point nearest to q, storing its value in *ret. Returns 1 on
+ * success and 0 on failure (empty tree). */
+int kd_nearest(const struct kdtree *kd, const struct point *q,
+	       struct point *ret);
+
+/* Find the k stored points nearest to q, storing them in ret[0..k-1], closest
+ * first. Returns the number of points stored, which is smaller than k when the
+ * tree holds fewer than k points, or -1 when out of memory. */
+int kd_nearest_k(const struct kdtree *kd, const struct point *q, int k,
+		 struct point *ret);
+
+/* Find the stored points whose distance from q is at most radius. Up to max of
+ * them are stored in ret, in no particular order. Returns the total number of
+ * points within radius, which can be larger than max. */
+int kd_radius(const struct kdtree *kd, const struct point *q, double radius,
+	      struct point *ret, int max);
+
+#endif /* _KDTREE_H_ */
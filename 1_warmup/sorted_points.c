@@ -6,303 +6,447 @@
 #include "sorted_points.h"
 #include "math.h"
 
-struct sorted_points {
+/* a point, with its distance from the origin */
+struct sp_elem {
 	double xpt;
 	double ypt;
 	double dist;
-	struct sorted_points *next;
-	/* you can define this struct to have whatever fields you want. */
 };
 
-struct sorted_points *sp_init()
+/* one point on the sorted list, or on the unsorted buffer of a lazy list */
+struct sp_node {
+	struct sp_elem e;
+	struct sp_node *next;
+};
+
+struct sorted_points {
+	enum sp_backend backend;
+	/* head.next is the first point on the sorted list */
+	struct sp_node head;
+	/* SP_LIST_LAZY only: points added since the list was last needed in
+	 * order, most recent first. */
+	struct sp_node *pending;
+	/* SP_MINMAX_HEAP only: array-backed min-max heap of nr_heap points */
+	struct sp_elem *heap;
+	int nr_heap;
+	int max_heap;
+};
+
+/* returns 1 when a should appear before b on the sorted list */
+static inline int
+sp_before(const struct sp_elem *a, const struct sp_elem *b)
 {
-	struct sorted_points *sp;
-	
-	sp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
-	if (sp==NULL)
-		return 0;
-	assert(sp);
-	
-	sp->next=NULL;	
-	return sp;
+	if (a->dist != b->dist)
+		return a->dist < b->dist;
+	if (a->xpt != b->xpt)
+		return a->xpt < b->xpt;
+	return a->ypt < b->ypt;
 }
 
-void
-sp_destroy(struct sorted_points *sp)
+/* merge two sorted lists */
+static struct sp_node *
+sp_merge(struct sp_node *a, struct sp_node *b)
 {
-	struct sorted_points *current,*temp;
-	current=sp;
-
-	while(current->next != NULL)
-	{
-		temp=current->next->next;
-		free(current->next);
-		current->next = temp;
+	struct sp_node head;
+	struct sp_node *tail = &head;
+
+	while (a != NULL && b != NULL) {
+		if (sp_before(&b->e, &a->e)) {
+			tail->next = b;
+			b = b->next;
+		} else {
+			tail->next = a;
+			a = a->next;
+		}
+		tail = tail->next;
 	}
+	tail->next = (a != NULL) ? a : b;
+	return head.next;
+}
 
-	free(sp);
+/* bottom-up merge sort. bins[i] holds a sorted run of 2^i nodes. */
+static struct sp_node *
+sp_sort(struct sp_node *list)
+{
+	struct sp_node *bins[64] = { NULL };
+	struct sp_node *next;
+	int i;
+
+	while (list != NULL) {
+		next = list->next;
+		list->next = NULL;
+		for (i = 0; bins[i] != NULL; i++) {
+			list = sp_merge(bins[i], list);
+			bins[i] = NULL;
+		}
+		bins[i] = list;
+		list = next;
+	}
+	for (i = 0; i < 64; i++) {
+		if (bins[i] != NULL)
+			list = sp_merge(bins[i], list);
+	}
+	return list;
 }
 
-int
-sp_add_point(struct sorted_points *sp, double x, double y)
+/* merge the unsorted buffer of a lazy list into the sorted list. this must be
+ * done before any operation that depends on the order of the points. */
+static inline void
+sp_flush(struct sorted_points *sp)
 {
-	double dt=sqrt((x*x)+(y*y));
-	int retint=-1;
-
-	struct sorted_points *current, *temp;
-	current = sp;
-	
-	//if linked list is empty
-	if (sp->next == NULL)
-	{
-		temp=(struct sorted_points *)malloc(sizeof(struct sorted_points));
-		if (temp == NULL)
-			return 0;
-		//current=sp->next;
-		temp->xpt=x;
-		temp->ypt=y;
-		temp->dist = dt;
-		temp->next = NULL;
-		sp->next=temp;
-		return 1;
+	if (sp->pending == NULL)
+		return;
+	sp->head.next = sp_merge(sp->head.next, sp_sort(sp->pending));
+	sp->pending = NULL;
+}
+
+static void
+sp_free_list(struct sp_node *current)
+{
+	struct sp_node *temp;
+
+	while (current != NULL) {
+		temp = current->next;
+		free(current);
+		current = temp;
 	}
-	
-	//inserting at the first node.
-	else if ((dt < current->next->dist) || ( (dt == current->next->dist) && ((x <= current->next->xpt)&&(y <= current->next->ypt))))
-	{
-		temp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
-		if (temp==NULL)
-			return 0;
-		temp->xpt=x;
-		temp->ypt=y;
-		temp->dist=dt;
-		temp->next=sp->next;
-		sp->next=temp;
-		return 1;	
+}
+
+/* Min-max heap. Nodes on even levels (the root is on level 0) are no larger
+ * than any of their descendants, and nodes on odd levels are no smaller than
+ * any of their descendants. The first point is at the root and the last point
+ * is one of its children. */
+
+static inline int
+heap_min_level(int i)
+{
+	/* level of node i is floor(log2(i + 1)) */
+	return ((31 - __builtin_clz(i + 1)) & 1) == 0;
+}
+
+static inline void
+heap_swap(struct sp_elem *h, int i, int j)
+{
+	struct sp_elem tmp = h[i];
+
+	h[i] = h[j];
+	h[j] = tmp;
+}
+
+/* returns 1 when a should be closer to the root than b on a level of the
+ * given kind */
+static inline int
+heap_above(const struct sp_elem *a, const struct sp_elem *b, int min_level)
+{
+	return min_level ? sp_before(a, b) : sp_before(b, a);
+}
+
+/* move node i up through its grandparents, which are on the same kind of
+ * level */
+static void
+heap_bubble_up_level(struct sp_elem *h, int i, int min_level)
+{
+	int g;
+
+	while (i >= 3) {
+		g = ((i - 1) / 2 - 1) / 2;
+		if (!heap_above(&h[i], &h[g], min_level))
+			break;
+		heap_swap(h, i, g);
+		i = g;
 	}
-	
-
-	current=current->next;
-	
-
-	while (retint == -1)
-	{
-		//if last node is reached.
-		if (current->next ==NULL)
-		{
-			temp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
-			if (temp==NULL)
-				return 0;
-			temp->xpt=x;
-			temp->ypt=y;
-			temp->dist=dt;
-			temp->next=NULL;
-			current->next=temp;
-			retint=1;
-			return retint;
-		}
-		
-		//if next element's dist is bigger than current dt
-		else if ((dt < current->next->dist) || ( (dt == current->next->dist) && ((x <= current->next->xpt) && (y <= current->next->ypt))))
-		{
-				temp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
-				if (temp==NULL)
-					return 0;
-				temp->xpt=x;
-				temp->ypt=y;
-				temp->dist=dt;
-				temp->next=current->next;
-				current->next=temp;
-				retint=1;
-				return retint;
+}
+
+static void
+heap_bubble_up(struct sp_elem *h, int i)
+{
+	int p, min_level;
+
+	if (i == 0)
+		return;
+	p = (i - 1) / 2;
+	min_level = heap_min_level(i);
+	if (heap_above(&h[p], &h[i], min_level)) {
+		/* belongs on the other kind of level */
+		heap_swap(h, i, p);
+		heap_bubble_up_level(h, p, !min_level);
+	} else {
+		heap_bubble_up_level(h, i, min_level);
+	}
+}
+
+static void
+heap_trickle_down(struct sp_elem *h, int n, int i)
+{
+	int min_level = heap_min_level(i);
+	int m, c, last;
+
+	while (2 * i + 1 < n) {
+		/* find the topmost of the children and grandchildren */
+		m = 2 * i + 1;
+		if (m + 1 < n && heap_above(&h[m + 1], &h[m], min_level))
+			m = m + 1;
+		last = 4 * i + 6 < n ? 4 * i + 6 : n - 1;
+		for (c = 4 * i + 3; c <= last; c++) {
+			if (heap_above(&h[c], &h[m], min_level))
+				m = c;
 		}
+		if (!heap_above(&h[m], &h[i], min_level))
+			break;
+		heap_swap(h, i, m);
+		if (m <= 2 * i + 2)
+			break;
+		/* m is a grandchild, it may not belong below its parent */
+		if (heap_above(&h[(m - 1) / 2], &h[m], min_level))
+			heap_swap(h, m, (m - 1) / 2);
+		i = m;
+	}
+}
 
-		//if dist is the same
-		else if (dt == current->next->dist)
-		{
-			//dist is the same, but x point is larger.
-			if (x > current->next->xpt)
-			{
-				//traverse until x is smaller than next node, while dist is the same
-				while ((x>current->next->xpt) && (dt==current->next->dist))
-				{
-					current=current->next;
-
-					if (current->next==NULL)
-					{
-						temp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
-						if (temp==NULL)
-							return 0;
-						temp->xpt=x;
-						temp->ypt=y;
-						temp->dist=dt;
-						temp->next=NULL;
-						current->next=temp;
-						retint=1;
-						return retint;
-					}
-
-				}
-			
-								
-				//correct x spot found. now check y condition... equal or smaller than next node ypt
-				if (y <= current->next->ypt)
-				{
-					temp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
-					if (temp==NULL)
-						return 0;	
-					temp->xpt=x;
-					temp->ypt=y;
-					temp->dist=dt;
-					temp->next=current->next;
-					current->next=temp;
-					retint=1;
-					return retint;
-				}
-			
-				//if y is larger than next node ypt and dist is same 
-				else if ((y > current->next->ypt) && (dt==current->next->dist))
-				{
-					while ((y > current->next->ypt) && (dt==current->next->dist))
-					{
-						current=current->next;
-						
-						if (current->next==NULL)
-						{
-							temp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
-							if (temp==NULL)
-								return 0;
-							temp->xpt=x;
-							temp->ypt=y;
-							temp->dist=dt;
-							temp->next=NULL;
-							current->next=temp;
-							retint=1;
-							return retint;
-						}
-					}
-
-					
-				}
-
-				
-			//otherwise, this is the correct spot.
-			temp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
-			if (temp==NULL)
-				return 0;
-			temp->xpt=x;
-			temp->ypt=y;
-			temp->dist=dt;
-			temp->next=current->next;
-			current->next=temp;
-			retint=1;
-			return retint;
-			}
-		
-			
-			//if x is smaller or same but y is larger
-			else if (y > current->next->ypt)
-			{
-				//find correct spot
-				while ((y > current->next->ypt) && (dt==current->next->dist))
-				{
-								
-					current = current->next;
-					
-					if (current->next==NULL)
-					{
-						temp=(struct sorted_points *)malloc(sizeof(struct sorted_points));
-						if (temp==NULL)
-							return 0;
-						temp->xpt=x;
-						temp->ypt=y;
-						temp->dist=dt;
-						temp->next=NULL;
-						current->next=temp;
-						retint =1;
-						return retint;
-					}
-
-				}
-
-								//correct y spot
-				temp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
-				if (temp==NULL)
-					return 0;
-				temp->xpt=x;
-				temp->ypt=y;
-				temp->dist=dt;
-				temp->next=current->next;
-				current->next=temp;
-				retint=1;
-				return retint;
+static void
+heap_heapify(struct sp_elem *h, int n)
+{
+	int i;
+
+	for (i = n / 2 - 1; i >= 0; i--)
+		heap_trickle_down(h, n, i);
+}
+
+static int
+heap_push(struct sorted_points *sp, const struct sp_elem *e)
+{
+	if (sp->nr_heap == sp->max_heap) {
+		int max = sp->max_heap ? 2 * sp->max_heap : 16;
+		struct sp_elem *heap;
+
+		heap = realloc(sp->heap, max * sizeof(struct sp_elem));
+		if (heap == NULL)
+			return 0;
+		sp->heap = heap;
+		sp->max_heap = max;
+	}
+	sp->heap[sp->nr_heap] = *e;
+	heap_bubble_up(sp->heap, sp->nr_heap++);
+	return 1;
+}
+
+/* remove node i, which must be the root or one of its children, i.e., a
+ * node with no ancestors on its own kind of level */
+static void
+heap_remove_top(struct sorted_points *sp, int i, struct point *ret)
+{
+	ret->x = sp->heap[i].xpt;
+	ret->y = sp->heap[i].ypt;
+	sp->heap[i] = sp->heap[--sp->nr_heap];
+	if (i < sp->nr_heap)
+		heap_trickle_down(sp->heap, sp->nr_heap, i);
+}
+
+/* reorder h so that h[k] is the k-th point in order, with no later points
+ * before it and no earlier points after it. */
+static void
+heap_select(struct sp_elem *h, int n, int k)
+{
+	int lo = 0;
+	int hi = n - 1;
+
+	while (lo < hi) {
+		struct sp_elem pivot = h[lo + (hi - lo) / 2];
+		int i = lo;
+		int j = hi;
+
+		while (i <= j) {
+			while (sp_before(&h[i], &pivot))
+				i++;
+			while (sp_before(&pivot, &h[j]))
+				j--;
+			if (i <= j) {
+				heap_swap(h, i, j);
+				i++;
+				j--;
 			}
 		}
-			
-	//keep traversing if dt is bigger than next->dist
-	current = current->next;
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
 	}
+}
 
+static int
+heap_cmp(const void *a, const void *b)
+{
+	if (sp_before(a, b))
+		return -1;
+	if (sp_before(b, a))
+		return 1;
 	return 0;
 }
 
+/* the heap does not keep the points in order, so removing by index and
+ * deleting duplicates fall back to O(n) and O(n log n) paths that reorder the
+ * whole array and then rebuild the heap. */
+static int
+heap_remove_by_index(struct sorted_points *sp, int index, struct point *ret)
+{
+	if (index >= sp->nr_heap)
+		return 0;
+	heap_select(sp->heap, sp->nr_heap, index);
+	ret->x = sp->heap[index].xpt;
+	ret->y = sp->heap[index].ypt;
+	sp->heap[index] = sp->heap[--sp->nr_heap];
+	heap_heapify(sp->heap, sp->nr_heap);
+	return 1;
+}
+
+static int
+heap_delete_duplicates(struct sorted_points *sp)
+{
+	int i, n = 0;
+
+	if (sp->nr_heap == 0)
+		return 0;
+	qsort(sp->heap, sp->nr_heap, sizeof(struct sp_elem), heap_cmp);
+	for (i = 1; i < sp->nr_heap; i++) {
+		if (sp->heap[i].xpt != sp->heap[n].xpt ||
+		    sp->heap[i].ypt != sp->heap[n].ypt)
+			sp->heap[++n] = sp->heap[i];
+	}
+	n++;
+	i = sp->nr_heap - n;
+	sp->nr_heap = n;
+	/* a sorted array is already a valid min heap, but not a min-max heap */
+	heap_heapify(sp->heap, sp->nr_heap);
+	return i;
+}
 
+struct sorted_points *
+sp_init_backend(enum sp_backend backend)
+{
+	struct sorted_points *sp;
 
+	sp = (struct sorted_points *)malloc(sizeof(struct sorted_points));
+	if (sp == NULL)
+		return NULL;
+
+	sp->backend = backend;
+	sp->head.next = NULL;
+	sp->pending = NULL;
+	sp->heap = NULL;
+	sp->nr_heap = 0;
+	sp->max_heap = 0;
+	return sp;
+}
+
+struct sorted_points *
+sp_init()
+{
+	return sp_init_backend(SP_LIST);
+}
+
+void
+sp_destroy(struct sorted_points *sp)
+{
+	sp_free_list(sp->head.next);
+	sp_free_list(sp->pending);
+	free(sp->heap);
+	free(sp);
+}
 
 int
-sp_remove_first(struct sorted_points *sp, struct point *ret)
+sp_add_point(struct sorted_points *sp, double x, double y)
 {
-	struct sorted_points *temp;
+	struct sp_node *current, *temp;
+
+	if (sp->backend == SP_MINMAX_HEAP) {
+		struct sp_elem e = { x, y, sqrt((x * x) + (y * y)) };
 
+		return heap_push(sp, &e);
+	}
 
-	if (sp->next == NULL)
-	{
+	temp = (struct sp_node *)malloc(sizeof(struct sp_node));
+	if (temp == NULL)
 		return 0;
+	temp->e.xpt = x;
+	temp->e.ypt = y;
+	temp->e.dist = sqrt((x * x) + (y * y));
+
+	if (sp->backend == SP_LIST_LAZY) {
+		temp->next = sp->pending;
+		sp->pending = temp;
+		return 1;
 	}
 
-	ret->x=sp->next->xpt;
-	ret->y=sp->next->ypt;
-	
-	temp= sp->next->next;
-	free(sp->next);
-	sp->next= temp;
+	//find the first node that should not appear before the new one
+	current = &sp->head;
+	while (current->next != NULL &&
+	       sp_before(&current->next->e, &temp->e))
+		current = current->next;
+	temp->next = current->next;
+	current->next = temp;
+	return 1;
+}
 
-	
+int
+sp_remove_first(struct sorted_points *sp, struct point *ret)
+{
+	struct sp_node *temp;
+
+	if (sp->backend == SP_MINMAX_HEAP) {
+		if (sp->nr_heap == 0)
+			return 0;
+		heap_remove_top(sp, 0, ret);
+		return 1;
+	}
+
+	sp_flush(sp);
+	if (sp->head.next == NULL)
+		return 0;
+
+	temp = sp->head.next;
+	ret->x = temp->e.xpt;
+	ret->y = temp->e.ypt;
+	sp->head.next = temp->next;
+	free(temp);
 	return 1;
 }
 
 int
 sp_remove_last(struct sorted_points *sp, struct point *ret)
 {
-	struct sorted_points *current, *temp;
-	current = sp;
-		
-	if (current->next == NULL)
-	{	
-		return 0;
-	}
-	
-	/*else if (current->next->next==NULL)
-	{
-		printf("B\n");
-		ret->x=current->next->xpt;
-		ret->y=current->next->ypt;
-		free(current->next);
-		sp->next=NULL;
+	struct sp_node *current, *temp;
+
+	if (sp->backend == SP_MINMAX_HEAP) {
+		if (sp->nr_heap == 0)
+			return 0;
+		/* the last point is the larger child of the root */
+		if (sp->nr_heap == 1)
+			heap_remove_top(sp, 0, ret);
+		else if (sp->nr_heap == 2 ||
+			 sp_before(&sp->heap[2], &sp->heap[1]))
+			heap_remove_top(sp, 1, ret);
+		else
+			heap_remove_top(sp, 2, ret);
 		return 1;
 	}
-	*/
 
-	while (current->next != NULL)
-	{
-		temp=current;
-		current=current->next;	
+	sp_flush(sp);
+	if (sp->head.next == NULL)
+		return 0;
+
+	temp = &sp->head;
+	current = temp->next;
+	while (current->next != NULL) {
+		temp = current;
+		current = current->next;
 	}
-		
-	ret->x = current->xpt;
-	ret->y = current->ypt;
+
+	ret->x = current->e.xpt;
+	ret->y = current->e.ypt;
 	free(current);
-	temp->next=NULL;
+	temp->next = NULL;
 	return 1;
 }
 
@@ -310,111 +454,56 @@ int
 sp_remove_by_index(struct sorted_points *sp, int index, struct point *ret)
 {
 	//i is index of whole linked list
-	int i=0;
-	struct sorted_points *current, *temp;
-	current = sp;
-	
-	if (sp->next == NULL)
-	{
-		return 0;
-	}
+	int i = 0;
+	struct sp_node *current, *temp;
 
-	while (current->next != NULL)
-	{
-		temp=current;
-		current=current->next;
-		if (i==index)
-		{
-			ret->x=current->xpt;
-			ret->y=current->ypt;
-			temp->next=current->next;
+	if (index < 0)
+		return 0;
+	if (sp->backend == SP_MINMAX_HEAP)
+		return heap_remove_by_index(sp, index, ret);
+	sp_flush(sp);
+
+	temp = &sp->head;
+	current = temp->next;
+	while (current != NULL) {
+		if (i == index) {
+			ret->x = current->e.xpt;
+			ret->y = current->e.ypt;
+			temp->next = current->next;
 			free(current);
 			return 1;
 		}
-	i++;
-	}
-	return 0;
-
-
-	/*
-	while (current->next != NULL)
-	{
-		current=current->next;
+		temp = current;
+		current = current->next;
 		i++;
 	}
-	
-	if (i==-1)
-	{
-		return 0;
-	}
-
-	if(index==0)
-	{
-		ret->x=sp->next->xpt;
-		ret->y=sp->next->ypt;
-		free(sp->next);
-		sp->next=NULL;
-		return 1;
-	}
-
-	else if(index>i)
-	{
-		return 0;
-	}
-	
-
-	//we have total index number in i, now do the real traversing
-   	//set current back to sp.
-	current = sp;
-
-	for(a=0; a<index; a++)
-	{
-		current=current->next;
-	}
-	
-	temp = current->next->next;
-	ret->x=current->next->xpt;
-	ret->y=current->next->ypt;
-	free(current->next);
-	current->next=temp;
-
-	//again,wrong code
-	//current->next=temp->next->next;
-	//free(temp->next);
-	return 1;
-	*/
+	return 0;
 }
 
 int
 sp_delete_duplicates(struct sorted_points *sp)
 {
-	struct sorted_points *current,*temp;
-	current = sp;
-	int count=0;
-	
-	if ((current->next->next == NULL)||(current->next==NULL))
-	{
+	struct sp_node *current, *temp;
+	int count = 0;
+
+	if (sp->backend == SP_MINMAX_HEAP)
+		return heap_delete_duplicates(sp);
+	sp_flush(sp);
+	current = sp->head.next;
+	if (current == NULL)
 		return 0;
-	}
-	
-	while (current->next != NULL)
-	{
-		if ((current->dist==current->next->dist) && (current->xpt==current->next->xpt) && (current->ypt==current->next->ypt))
-		{
-			temp=current->next->next;
+
+	//duplicates are next to each other on the sorted list
+	while (current->next != NULL) {
+		if ((current->e.xpt == current->next->e.xpt) &&
+		    (current->e.ypt == current->next->e.ypt)) {
+			temp = current->next->next;
 			free(current->next);
-			current->next=temp;
+			current->next = temp;
 			count++;
-		}
-		else
-		{
-		current=current->next;
+		} else {
+			current = current->next;
 		}
 	}
-	
 	return count;
 }
-
-
-
-
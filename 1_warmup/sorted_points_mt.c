@@ -0,0 +1,413 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+#include "point.h"
+#include "sorted_points_mt.h"
+#include "math.h"
+
+#define SPMT_MAX_LEVEL 24
+/* try to advance the global epoch after this many removals by a thread */
+#define SPMT_ADVANCE 64
+
+/* The next pointers of a node carry a mark in their lowest bit. A marked
+ * next[i] means that the node is being deleted and must be unlinked from
+ * level i. */
+#define MARK(p)		((uintptr_t)(p) | 1)
+#define UNMARK(p)	((struct spmt_node *)((uintptr_t)(p) & ~(uintptr_t)1))
+#define MARKED(p)	((uintptr_t)(p) & 1)
+
+struct spmt_node {
+	double dist;
+	double x;
+	double y;
+	/* insertion order, so that no two nodes have the same key */
+	unsigned long seq;
+	int level;
+	/* set by the inserter once all levels are linked. only such nodes can
+	 * be removed, so nobody links a node after it has been removed. */
+	int linked;
+	/* set by the spmt_remove_first() call that removes this node */
+	int taken;
+	/* link on the retired list of a thread */
+	struct spmt_node *retire_next;
+	uintptr_t next[];
+};
+
+/* per thread epoch state, padded so that threads do not share cache lines */
+struct spmt_thread {
+	/* (epoch << 1) | 1 while in an operation, 0 otherwise */
+	unsigned long state;
+	/* retired nodes, kept by global epoch at retire time modulo 3 */
+	struct spmt_node *limbo[3];
+	unsigned long limbo_epoch[3];
+	unsigned long nr_retired;
+} __attribute__((aligned(64)));
+
+struct sorted_points_mt {
+	struct spmt_node *head;
+	unsigned long seq;
+	unsigned long epoch __attribute__((aligned(64)));
+	struct spmt_thread threads[SPMT_MAX_THREADS];
+};
+
+/* each thread using this module owns a slot in threads[]. a slot is released
+ * when its thread exits, and its retired nodes are then freed by the next
+ * owner. spmt_nr_slots is the highest slot ever used, plus one. */
+static int spmt_slot_used[SPMT_MAX_THREADS];
+static int spmt_nr_slots;
+static pthread_key_t spmt_slot_key;
+static pthread_once_t spmt_slot_once = PTHREAD_ONCE_INIT;
+static __thread int spmt_slot = -1;
+static __thread unsigned int spmt_seed;
+
+static void
+spmt_slot_release(void *arg)
+{
+	long slot = (long)arg - 1;
+
+	__atomic_store_n(&spmt_slot_used[slot], 0, __ATOMIC_RELEASE);
+}
+
+static void
+spmt_slot_init(void)
+{
+	int ret = pthread_key_create(&spmt_slot_key, spmt_slot_release);
+	assert(!ret);
+}
+
+static struct spmt_thread *
+spmt_self(struct sorted_points_mt *sp)
+{
+	int slot, nr_slots;
+
+	if (spmt_slot < 0) {
+		pthread_once(&spmt_slot_once, spmt_slot_init);
+		for (slot = 0; slot < SPMT_MAX_THREADS; slot++) {
+			if (!__atomic_load_n(&spmt_slot_used[slot],
+					     __ATOMIC_RELAXED) &&
+			    !__atomic_exchange_n(&spmt_slot_used[slot], 1,
+						 __ATOMIC_ACQUIRE))
+				break;
+		}
+		assert(slot < SPMT_MAX_THREADS);
+		nr_slots = __atomic_load_n(&spmt_nr_slots, __ATOMIC_RELAXED);
+		while (nr_slots <= slot &&
+		       !__atomic_compare_exchange_n(&spmt_nr_slots, &nr_slots,
+						    slot + 1, 0,
+						    __ATOMIC_SEQ_CST,
+						    __ATOMIC_RELAXED))
+			;
+		pthread_setspecific(spmt_slot_key, (void *)(long)(slot + 1));
+		spmt_slot = slot;
+		spmt_seed = 2654435761u * (slot + 1);
+	}
+	return &sp->threads[spmt_slot];
+}
+
+/* returns 1 when a should appear before b */
+static inline int
+spmt_before(const struct spmt_node *a, const struct spmt_node *b)
+{
+	if (a->dist != b->dist)
+		return a->dist < b->dist;
+	if (a->x != b->x)
+		return a->x < b->x;
+	if (a->y != b->y)
+		return a->y < b->y;
+	return a->seq < b->seq;
+}
+
+static inline uintptr_t
+spmt_next(struct spmt_node *node, int level)
+{
+	return __atomic_load_n(&node->next[level], __ATOMIC_ACQUIRE);
+}
+
+static inline int
+spmt_cas(uintptr_t *ptr, uintptr_t old, uintptr_t new)
+{
+	return __atomic_compare_exchange_n(ptr, &old, new, 0,
+					   __ATOMIC_SEQ_CST,
+					   __ATOMIC_RELAXED);
+}
+
+/* geometric level distribution, p = 1/2 */
+static int
+spmt_random_level(void)
+{
+	int level = 1;
+
+	spmt_seed ^= spmt_seed << 13;
+	spmt_seed ^= spmt_seed >> 17;
+	spmt_seed ^= spmt_seed << 5;
+	while (((spmt_seed >> (level - 1)) & 1) && level < SPMT_MAX_LEVEL)
+		level++;
+	return level;
+}
+
+static struct spmt_node *
+spmt_alloc(int level)
+{
+	struct spmt_node *node;
+	int i;
+
+	node = malloc(sizeof(struct spmt_node) + level * sizeof(uintptr_t));
+	if (node == NULL)
+		return NULL;
+	node->level = level;
+	node->linked = 0;
+	node->taken = 0;
+	for (i = 0; i < level; i++)
+		node->next[i] = 0;
+	return node;
+}
+
+static void
+spmt_free_list(struct spmt_node *current)
+{
+	struct spmt_node *temp;
+
+	while (current != NULL) {
+		temp = current->retire_next;
+		free(current);
+		current = temp;
+	}
+}
+
+/* start an operation. nodes retired two or more epochs ago can no longer be
+ * referenced by anyone, so they are freed here. */
+static void
+spmt_enter(struct sorted_points_mt *sp, struct spmt_thread *t)
+{
+	unsigned long epoch = __atomic_load_n(&sp->epoch, __ATOMIC_ACQUIRE);
+	int i;
+
+	__atomic_store_n(&t->state, (epoch << 1) | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (i = 0; i < 3; i++) {
+		if (t->limbo[i] != NULL && t->limbo_epoch[i] + 2 <= epoch) {
+			spmt_free_list(t->limbo[i]);
+			t->limbo[i] = NULL;
+		}
+	}
+}
+
+static void
+spmt_exit(struct spmt_thread *t)
+{
+	__atomic_store_n(&t->state, 0, __ATOMIC_RELEASE);
+}
+
+/* move to the next epoch if every thread in an operation has seen the
+ * current one */
+static void
+spmt_try_advance(struct sorted_points_mt *sp)
+{
+	unsigned long epoch = __atomic_load_n(&sp->epoch, __ATOMIC_ACQUIRE);
+	unsigned long state;
+	int nr_slots = __atomic_load_n(&spmt_nr_slots, __ATOMIC_RELAXED);
+	int i;
+
+	if (nr_slots > SPMT_MAX_THREADS)
+		nr_slots = SPMT_MAX_THREADS;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (i = 0; i < nr_slots; i++) {
+		state = __atomic_load_n(&sp->threads[i].state,
+					__ATOMIC_ACQUIRE);
+		if ((state & 1) && (state >> 1) != epoch)
+			return;
+	}
+	__atomic_compare_exchange_n(&sp->epoch, &epoch, epoch + 1, 0,
+				    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/* queue an unlinked node to be freed once no thread can reference it. threads
+ * that found the node did so in an epoch no later than the current one, and
+ * the epoch cannot move two steps past theirs while they are still active. */
+static void
+spmt_retire(struct sorted_points_mt *sp, struct spmt_thread *t,
+	    struct spmt_node *node)
+{
+	unsigned long epoch = __atomic_load_n(&sp->epoch, __ATOMIC_ACQUIRE);
+	int i = epoch % 3;
+
+	/* an older list in this slot is at least three epochs old */
+	if (t->limbo[i] != NULL && t->limbo_epoch[i] != epoch) {
+		spmt_free_list(t->limbo[i]);
+		t->limbo[i] = NULL;
+	}
+	node->retire_next = t->limbo[i];
+	t->limbo[i] = node;
+	t->limbo_epoch[i] = epoch;
+	if (++t->nr_retired % SPMT_ADVANCE == 0)
+		spmt_try_advance(sp);
+}
+
+/* find the predecessors and successors of key at every level, unlinking any
+ * marked nodes on the way. succs[0] == key when key is still linked at the
+ * bottom level. */
+static void
+spmt_find(struct sorted_points_mt *sp, const struct spmt_node *key,
+	  struct spmt_node **preds, struct spmt_node **succs)
+{
+	struct spmt_node *pred, *curr;
+	uintptr_t succ;
+	int level;
+
+retry:
+	pred = sp->head;
+	for (level = SPMT_MAX_LEVEL - 1; level >= 0; level--) {
+		curr = UNMARK(spmt_next(pred, level));
+		while (curr != NULL) {
+			succ = spmt_next(curr, level);
+			while (MARKED(succ)) {
+				if (!spmt_cas(&pred->next[level],
+					      (uintptr_t)curr,
+					      (uintptr_t)UNMARK(succ)))
+					goto retry;
+				curr = UNMARK(succ);
+				if (curr == NULL)
+					break;
+				succ = spmt_next(curr, level);
+			}
+			if (curr == NULL || !spmt_before(curr, key))
+				break;
+			pred = curr;
+			curr = UNMARK(succ);
+		}
+		preds[level] = pred;
+		succs[level] = curr;
+	}
+}
+
+struct sorted_points_mt *
+spmt_init(void)
+{
+	struct sorted_points_mt *sp;
+	int i;
+
+	/* keep the per thread state on separate cache lines */
+	if (posix_memalign((void **)&sp, 64, sizeof(struct sorted_points_mt)))
+		return NULL;
+	sp->head = spmt_alloc(SPMT_MAX_LEVEL);
+	if (sp->head == NULL) {
+		free(sp);
+		return NULL;
+	}
+	sp->seq = 0;
+	sp->epoch = 0;
+	for (i = 0; i < SPMT_MAX_THREADS; i++) {
+		sp->threads[i].state = 0;
+		sp->threads[i].limbo[0] = NULL;
+		sp->threads[i].limbo[1] = NULL;
+		sp->threads[i].limbo[2] = NULL;
+		sp->threads[i].nr_retired = 0;
+	}
+	return sp;
+}
+
+void
+spmt_destroy(struct sorted_points_mt *sp)
+{
+	struct spmt_node *current, *temp;
+	int i;
+
+	/* removed nodes have all been unlinked by their removers */
+	current = UNMARK(sp->head->next[0]);
+	while (current != NULL) {
+		temp = UNMARK(current->next[0]);
+		free(current);
+		current = temp;
+	}
+	for (i = 0; i < SPMT_MAX_THREADS; i++) {
+		spmt_free_list(sp->threads[i].limbo[0]);
+		spmt_free_list(sp->threads[i].limbo[1]);
+		spmt_free_list(sp->threads[i].limbo[2]);
+	}
+	free(sp->head);
+	free(sp);
+}
+
+int
+spmt_add_point(struct sorted_points_mt *sp, double x, double y)
+{
+	struct spmt_thread *t = spmt_self(sp);
+	struct spmt_node *preds[SPMT_MAX_LEVEL], *succs[SPMT_MAX_LEVEL];
+	struct spmt_node *node;
+	int i;
+
+	node = spmt_alloc(spmt_random_level());
+	if (node == NULL)
+		return 0;
+	node->x = x;
+	node->y = y;
+	node->dist = sqrt((x * x) + (y * y));
+	node->seq = __atomic_fetch_add(&sp->seq, 1, __ATOMIC_RELAXED);
+
+	spmt_enter(sp, t);
+	/* the bottom level decides membership */
+	do {
+		spmt_find(sp, node, preds, succs);
+		for (i = 0; i < node->level; i++)
+			node->next[i] = (uintptr_t)succs[i];
+	} while (!spmt_cas(&preds[0]->next[0], (uintptr_t)succs[0],
+			   (uintptr_t)node));
+
+	/* the upper levels are only shortcuts. nobody else writes node->next[i]
+	 * before node is linked at level i. */
+	for (i = 1; i < node->level; i++) {
+		while (!spmt_cas(&preds[i]->next[i], (uintptr_t)succs[i],
+				 (uintptr_t)node)) {
+			spmt_find(sp, node, preds, succs);
+			__atomic_store_n(&node->next[i], (uintptr_t)succs[i],
+					 __ATOMIC_RELEASE);
+		}
+	}
+	__atomic_store_n(&node->linked, 1, __ATOMIC_RELEASE);
+	spmt_exit(t);
+	return 1;
+}
+
+int
+spmt_remove_first(struct sorted_points_mt *sp, struct point *ret)
+{
+	struct spmt_thread *t = spmt_self(sp);
+	struct spmt_node *preds[SPMT_MAX_LEVEL], *succs[SPMT_MAX_LEVEL];
+	struct spmt_node *curr;
+	uintptr_t succ;
+	int i;
+
+	spmt_enter(sp, t);
+	/* claim the first node that nobody else has claimed */
+	curr = UNMARK(spmt_next(sp->head, 0));
+	while (curr != NULL) {
+		succ = spmt_next(curr, 0);
+		if (!MARKED(succ) &&
+		    __atomic_load_n(&curr->linked, __ATOMIC_ACQUIRE) &&
+		    !__atomic_load_n(&curr->taken, __ATOMIC_RELAXED) &&
+		    !__atomic_exchange_n(&curr->taken, 1, __ATOMIC_ACQ_REL))
+			break;
+		curr = UNMARK(succ);
+	}
+	if (curr == NULL) {
+		spmt_exit(t);
+		return 0;
+	}
+	ret->x = curr->x;
+	ret->y = curr->y;
+
+	/* mark the node top down, then unlink it from every level */
+	for (i = curr->level - 1; i >= 0; i--) {
+		do {
+			succ = spmt_next(curr, i);
+		} while (!MARKED(succ) &&
+			 !spmt_cas(&curr->next[i], succ, MARK(succ)));
+	}
+	spmt_find(sp, curr, preds, succs);
+	spmt_retire(sp, t, curr);
+	spmt_exit(t);
+	return 1;
+}
@@ -0,0 +1,34 @@
+#ifndef _SORTEDPOINTS_MT_H_
+#define _SORTEDPOINTS_MT_H_
+#include "point.h"
+
+/* A thread-safe variant of sorted_points for producer/consumer use: any number
+ * of threads can add points and remove the first point concurrently. Points
+ * are ordered as in sorted_points.h.
+ *
+ * It is a lock-free skip list. Removed points are reclaimed with epoch based
+ * reclamation, i.e., a removed point is freed only after every thread that
+ * could still be looking at it has finished its operation. At most
+ * SPMT_MAX_THREADS threads can be using these functions at the same time. */
+#define SPMT_MAX_THREADS 128
+
+/* Forward declaration of structure for the function declarations below. */
+struct sorted_points_mt;
+
+/* Initialize data structure, returning pointer to a new object, or NULL when
+ * out of memory. */
+struct sorted_points_mt *spmt_init(void);
+
+/* Destroy data structure. No other thread may be using it. */
+void spmt_destroy(struct sorted_points_mt *sp);
+
+/* Add the point x,y. Return 1 on success and 0 on error (e.g., out of
+ * memory). */
+int spmt_add_point(struct sorted_points_mt *sp, double x, double y);
+
+/* Remove the first point, storing its value in *ret. Returns 1 on success and
+ * 0 on failure (empty list). A point whose spmt_add_point() call has not
+ * returned yet may be skipped. */
+int spmt_remove_first(struct sorted_points_mt *sp, struct point *ret);
+
+#endif /* _SORTEDPOINTS_MT_H_ */
@@ -0,0 +1,234 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "point.h"
+#include "kdtree.h"
+
+static void basic_test();
+static void sorted_insert_test();
+static void random_test();
+
+int
+main(int argc, char **argv)
+{
+	srand(0);
+	basic_test();
+	sorted_insert_test();
+	random_test();
+
+	printf("OK\n");
+	return 0;
+}
+
+/* returns 1 when p1 should be reported before p2 for query q */
+static int
+closer(const struct point *q, const struct point *p1, const struct point *p2)
+{
+	double d1 = point_distance(q, p1);
+	double d2 = point_distance(q, p2);
+
+	if (d1 != d2)
+		return d1 < d2;
+	if (point_X(p1) != point_X(p2))
+		return point_X(p1) < point_X(p2);
+	return point_Y(p1) < point_Y(p2);
+}
+
+static const struct point *sort_query;
+
+static int
+cmp_query(const void *a, const void *b)
+{
+	const struct point *p1 = a;
+	const struct point *p2 = b;
+
+	if (closer(sort_query, p1, p2))
+		return -1;
+	if (closer(sort_query, p2, p1))
+		return 1;
+	return 0;
+}
+
+/* check all queries against a brute force search over pts */
+static void
+check_queries(struct kdtree *kd, struct point *pts, int n,
+	      const struct point *q)
+{
+	struct point *sorted, *ret;
+	struct point p1;
+	int k, ret_k, i, count;
+	double radius;
+
+	assert(kd_size(kd) == n);
+	sorted = malloc((n + 1) * sizeof(struct point));
+	ret = malloc((n + 1) * sizeof(struct point));
+	assert(sorted && ret);
+	for (i = 0; i < n; i++)
+		sorted[i] = pts[i];
+	sort_query = q;
+	qsort(sorted, n, sizeof(struct point), cmp_query);
+
+	ret_k = kd_nearest(kd, q, &p1);
+	assert(ret_k == (n > 0));
+	if (n > 0) {
+		assert(point_X(&p1) == point_X(&sorted[0]));
+		assert(point_Y(&p1) == point_Y(&sorted[0]));
+	}
+
+	k = rand() % 20 + 1;
+	ret_k = kd_nearest_k(kd, q, k, ret);
+	assert(ret_k == (k < n ? k : n));
+	for (i = 0; i < ret_k; i++) {
+		assert(point_X(&ret[i]) == point_X(&sorted[i]));
+		assert(point_Y(&ret[i]) == point_Y(&sorted[i]));
+	}
+
+	radius = (double)(rand() % 30);
+	for (count = 0; count < n; count++) {
+		if (point_distance(q, &sorted[count]) > radius)
+			break;
+	}
+	ret_k = kd_radius(kd, q, radius, ret, n + 1);
+	assert(ret_k == count);
+	for (i = 0; i < ret_k; i++) {
+		assert(point_distance(q, &ret[i]) <= radius);
+	}
+	/* results beyond max are counted but not stored */
+	if (count > 1) {
+		ret_k = kd_radius(kd, q, radius, ret, 1);
+		assert(ret_k == count);
+	}
+	/* asking for every point reports the whole set in order */
+	ret_k = kd_nearest_k(kd, q, n, ret);
+	assert(ret_k == n);
+	for (i = 0; i < n; i++) {
+		assert(point_X(&ret[i]) == point_X(&sorted[i]));
+		assert(point_Y(&ret[i]) == point_Y(&sorted[i]));
+	}
+	free(sorted);
+	free(ret);
+}
+
+static void
+basic_test()
+{
+	struct kdtree *kd;
+	struct point p1, q;
+	struct point pts[4];
+	int ret;
+
+	kd = kd_init();
+	assert(kd);
+	point_set(&q, 0.0, 0.0);
+
+	// empty tree checks
+	ret = kd_nearest(kd, &q, &p1);
+	assert(!ret);
+	ret = kd_nearest_k(kd, &q, 3, pts);
+	assert(ret == 0);
+	ret = kd_radius(kd, &q, 10.0, pts, 4);
+	assert(ret == 0);
+
+	ret = kd_add_point(kd, 3.0, 4.0);
+	assert(ret);
+	ret = kd_add_point(kd, 1.0, 1.0);
+	assert(ret);
+	ret = kd_add_point(kd, -1.0, 1.0);
+	assert(ret);
+	ret = kd_add_point(kd, 1.0, -1.0);
+	assert(ret);
+	assert(kd_size(kd) == 4);
+
+	/* ties are broken by x, then y */
+	ret = kd_nearest(kd, &q, &p1);
+	assert(ret);
+	assert(point_X(&p1) == -1.0);
+	assert(point_Y(&p1) == 1.0);
+
+	ret = kd_nearest_k(kd, &q, 4, pts);
+	assert(ret == 4);
+	assert(point_X(&pts[1]) == 1.0 && point_Y(&pts[1]) == -1.0);
+	assert(point_X(&pts[2]) == 1.0 && point_Y(&pts[2]) == 1.0);
+	assert(point_X(&pts[3]) == 3.0 && point_Y(&pts[3]) == 4.0);
+
+	point_set(&q, 3.0, 3.0);
+	ret = kd_nearest(kd, &q, &p1);
+	assert(ret);
+	assert(point_X(&p1) == 3.0);
+	assert(point_Y(&p1) == 4.0);
+
+	ret = kd_radius(kd, &q, 1.0, pts, 4);
+	assert(ret == 1);
+	ret = kd_radius(kd, &q, 3.0, pts, 4);
+	assert(ret == 2);
+
+	kd_destroy(kd);
+}
+
+/* inserting in sorted order must not degrade the tree */
+static void
+sorted_insert_test()
+{
+	static const int NINSERT = 64 * 1024;
+	struct kdtree *kd;
+	struct point q, p1;
+	int ii, ret;
+
+	kd = kd_init();
+	assert(kd);
+	for (ii = 0; ii < NINSERT; ii++) {
+		ret = kd_add_point(kd, (double)ii, 1.0);
+		assert(ret);
+	}
+	assert(kd_size(kd) == NINSERT);
+	for (ii = 0; ii < NINSERT; ii += 97) {
+		point_set(&q, (double)ii + 0.25, 0.0);
+		ret = kd_nearest(kd, &q, &p1);
+		assert(ret);
+		assert(point_X(&p1) == (double)ii);
+	}
+	kd_destroy(kd);
+}
+
+static void
+random_test()
+{
+	static const int NRUNS = 64;
+	static const int MAXSIZE = 2048;
+	static const int NQUERIES = 16;
+	struct kdtree *kd;
+	struct point *pts;
+	struct point q;
+	int i, j, size, ret;
+
+	pts = malloc(MAXSIZE * sizeof(struct point));
+	assert(pts);
+	for (i = 0; i < NRUNS; i++) {
+		size = rand() % MAXSIZE;
+		for (j = 0; j < size; j++) {
+			point_set(&pts[j], (double)(rand() % 64 - 32),
+				  (double)(rand() % 64 - 32));
+		}
+
+		/* bulk build, then grow the tree incrementally */
+		kd = kd_build(pts, size / 2);
+		assert(kd);
+		for (j = 0; j < NQUERIES; j++) {
+			point_set(&q, (double)(rand() % 80 - 40),
+				  (double)(rand() % 80 - 40));
+			check_queries(kd, pts, size / 2, &q);
+		}
+		for (j = size / 2; j < size; j++) {
+			ret = kd_add_point(kd, point_X(&pts[j]),
+					   point_Y(&pts[j]));
+			assert(ret);
+		}
+		for (j = 0; j < NQUERIES; j++) {
+			point_set(&q, (double)(rand() % 80 - 40),
+				  (double)(rand() % 80 - 40));
+			check_queries(kd, pts, size, &q);
+		}
+		kd_destroy(kd);
+	}
+	free(pts);
+}
@@ -8,16 +8,29 @@
 static void basic_test();
 static void stress_test();
 static void random_test();
+static void backend_test();
+
+/* backend used by the tests above */
+static enum sp_backend backend;
+static const enum sp_backend backends[] = { SP_LIST, SP_LIST_LAZY,
+					     SP_MINMAX_HEAP };
+#define NBACKENDS (int)(sizeof(backends) / sizeof(backends[0]))
 
 int
 main(int argc, char **argv)
 {
 	struct mallinfo end_info;
+	int i;
 
-	srand(0);
-	basic_test();
-	stress_test();
-	random_test();
+	for (i = 0; i < NBACKENDS; i++) {
+		backend = backends[i];
+		printf("testing backend %d\n", backend);
+		srand(0);
+		basic_test();
+		stress_test();
+		random_test();
+	}
+	backend_test();
 	end_info = mallinfo();
 
 	assert(end_info.uordblks == 0);
@@ -30,7 +43,7 @@ main(int argc, char **argv)
 static struct sorted_points *
 alloc_random_list(int num)
 {
-	struct sorted_points *sp = sp_init();
+	struct sorted_points *sp = sp_init_backend(backend);
 	int i;
 	int ret;
 
@@ -101,8 +114,8 @@ basic_test()
 	struct point p1;
 
 	srand(0);
-	sp1 = sp_init();
-	sp2 = sp_init();
+	sp1 = sp_init_backend(backend);
+	sp2 = sp_init_backend(backend);
 
 	// empty list checks
 	ret = sp_remove_by_index(sp1, 1, &p1);
@@ -228,7 +241,7 @@ stress_test()
 	int jj;
 	int ret;
 
-	sp = sp_init();
+	sp = sp_init_backend(backend);
 	printf("this test may take a minute.\n");
 
 	for (ii = 0; ii < NITER; ii++) {
@@ -248,3 +261,73 @@ stress_test()
 	}
 	sp_destroy(sp);
 }
+
+/* all backends must return the same points for the same operations */
+static void
+backend_test()
+{
+	struct sorted_points *sp[NBACKENDS];
+	/* the point to insert, the one a backend removed, and the one the
+	 * first backend removed */
+	struct point pnew, p1, pref;
+	static const int NOPS = 64 * 1024;
+	int size = 0;
+	int i, ii, op, index;
+	int ret, ret2;
+
+	srand(0);
+	for (i = 0; i < NBACKENDS; i++) {
+		sp[i] = sp_init_backend(backends[i]);
+		assert(sp[i]);
+	}
+	for (ii = 0; ii < NOPS; ii++) {
+		op = rand() % 16;
+		index = size > 0 ? rand() % (size + 1) : 0;
+		point_set(&pnew, (double)(rand() % 10 - 5),
+			  (double)(rand() % 10 - 5));
+		for (i = 0; i < NBACKENDS; i++) {
+			/* bursts of inserts, with occasional removals */
+			if (op < 10) {
+				ret = sp_add_point(sp[i], point_X(&pnew),
+						   point_Y(&pnew));
+				assert(ret);
+				continue;
+			}
+			/* not a point that is ever inserted */
+			point_set(&p1, 100.0, 100.0);
+			switch (op) {
+			case 10:
+			case 11:
+				ret = sp_remove_first(sp[i], &p1);
+				break;
+			case 12:
+			case 13:
+				ret = sp_remove_last(sp[i], &p1);
+				break;
+			case 14:
+				ret = sp_remove_by_index(sp[i], index, &p1);
+				break;
+			default:
+				ret = sp_delete_duplicates(sp[i]);
+				break;
+			}
+			if (i == 0) {
+				ret2 = ret;
+				pref = p1;
+			}
+			assert(ret == ret2);
+			/* a remove that succeeded wrote the point it removed */
+			if (op < 15 && ret) {
+				assert(point_X(&p1) != 100.0);
+				assert(point_X(&p1) == point_X(&pref));
+				assert(point_Y(&p1) == point_Y(&pref));
+			}
+		}
+		if (op < 10)
+			size++;
+		else
+			size -= ret;
+	}
+	for (i = 0; i < NBACKENDS; i++)
+		sp_destroy(sp[i]);
+}
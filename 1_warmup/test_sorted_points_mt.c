@@ -0,0 +1,184 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "point.h"
+#include "sorted_points.h"
+#include "sorted_points_mt.h"
+
+#define NTHREADS	8
+#define NPOINTS		(16 * 1024)
+
+static void order_test();
+static void producer_test();
+static void mixed_test();
+
+int
+main(int argc, char **argv)
+{
+	srand(0);
+	order_test();
+	producer_test();
+	mixed_test();
+
+	printf("OK\n");
+	return 0;
+}
+
+/* single threaded, the order must match sorted_points */
+static void
+order_test()
+{
+	struct sorted_points_mt *mt;
+	struct sorted_points *sp;
+	struct point p1, p2;
+	int ii, ret, ret2;
+
+	mt = spmt_init();
+	sp = sp_init();
+	assert(mt && sp);
+
+	ret = spmt_remove_first(mt, &p1);
+	assert(!ret);
+	for (ii = 0; ii < NPOINTS; ii++) {
+		double x = (double)(rand() % 10);
+		double y = (double)(rand() % 10);
+
+		ret = spmt_add_point(mt, x, y);
+		assert(ret);
+		ret = sp_add_point(sp, x, y);
+		assert(ret);
+		/* drain some points now and then */
+		if (rand() % 4 == 0) {
+			ret = spmt_remove_first(mt, &p1);
+			ret2 = sp_remove_first(sp, &p2);
+			assert(ret == ret2);
+			assert(point_X(&p1) == point_X(&p2));
+			assert(point_Y(&p1) == point_Y(&p2));
+		}
+	}
+	do {
+		ret = spmt_remove_first(mt, &p1);
+		ret2 = sp_remove_first(sp, &p2);
+		assert(ret == ret2);
+		if (ret) {
+			assert(point_X(&p1) == point_X(&p2));
+			assert(point_Y(&p1) == point_Y(&p2));
+		}
+	} while (ret);
+	spmt_destroy(mt);
+	sp_destroy(sp);
+}
+
+static struct sorted_points_mt *shared;
+/* seen[i] counts how often the point with x == i was removed */
+static int seen[NTHREADS * NPOINTS];
+static int nr_removed;
+
+static void *
+producer(void *arg)
+{
+	long num = (long)arg;
+	int ii, ret;
+
+	/* x identifies the point, y makes some of them tie on distance */
+	for (ii = 0; ii < NPOINTS; ii++) {
+		ret = spmt_add_point(shared, (double)(num * NPOINTS + ii),
+				     (double)(ii % 3));
+		assert(ret);
+	}
+	return NULL;
+}
+
+static void *
+consumer(void *arg)
+{
+	struct point p1;
+	int ret;
+
+	while (__atomic_load_n(&nr_removed, __ATOMIC_RELAXED) <
+	       NTHREADS * NPOINTS) {
+		ret = spmt_remove_first(shared, &p1);
+		if (!ret)
+			continue;
+		__atomic_fetch_add(&seen[(int)point_X(&p1)], 1,
+				   __ATOMIC_RELAXED);
+		__atomic_fetch_add(&nr_removed, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void
+run_threads(void *(*fn)(void *), pthread_t *tids)
+{
+	long i;
+	int ret;
+
+	for (i = 0; i < NTHREADS; i++) {
+		ret = pthread_create(&tids[i], NULL, fn, (void *)i);
+		assert(!ret);
+	}
+}
+
+static void
+join_threads(pthread_t *tids)
+{
+	int i;
+
+	for (i = 0; i < NTHREADS; i++)
+		pthread_join(tids[i], NULL);
+}
+
+/* concurrent inserts, then a sequential drain in order */
+static void
+producer_test()
+{
+	pthread_t tids[NTHREADS];
+	struct point p1, prev;
+	int ii, ret;
+
+	shared = spmt_init();
+	assert(shared);
+	run_threads(producer, tids);
+	join_threads(tids);
+
+	memset(seen, 0, sizeof(seen));
+	point_set(&prev, 0.0, 0.0);
+	for (ii = 0; ii < NTHREADS * NPOINTS; ii++) {
+		ret = spmt_remove_first(shared, &p1);
+		assert(ret);
+		assert(point_compare(&prev, &p1) <= 0);
+		seen[(int)point_X(&p1)]++;
+		prev = p1;
+	}
+	ret = spmt_remove_first(shared, &p1);
+	assert(!ret);
+	for (ii = 0; ii < NTHREADS * NPOINTS; ii++)
+		assert(seen[ii] == 1);
+	spmt_destroy(shared);
+}
+
+/* concurrent inserts and removals, every point is removed exactly once */
+static void
+mixed_test()
+{
+	pthread_t producers[NTHREADS], consumers[NTHREADS];
+	struct point p1;
+	int ii, ret;
+
+	shared = spmt_init();
+	assert(shared);
+	memset(seen, 0, sizeof(seen));
+	nr_removed = 0;
+	run_threads(consumer, consumers);
+	run_threads(producer, producers);
+	join_threads(producers);
+	join_threads(consumers);
+
+	ret = spmt_remove_first(shared, &p1);
+	assert(!ret);
+	for (ii = 0; ii < NTHREADS * NPOINTS; ii++)
+		assert(seen[ii] == 1);
+	spmt_destroy(shared);
+}
@@ -0,0 +1,394 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include "thread.h"
+#include "sync.h"
+#include "chan.h"
+
+/* Measures the synchronization primitives of sync.h. A read-mostly workload,
+ * where one operation in WRITE_EVERY writes, runs under a reader-writer lock
+ * and then under a plain lock. Each operation sleeps for HOLD_USECS inside
+ * the critical section, as if it waited for a device, so readers that hold
+ * the lock together finish sooner. Then two threads pass a token back and
+ * forth through a pair of semaphores, and a number of threads meet at a
+ * barrier over and over. Last, messages pass through a pipeline of stages,
+ * connected by channels, and then by buffers guarded by a lock and condition
+ * variables, and a thread echoes messages back over each kind of connection.
+ * Prints the average time of one operation, one semaphore handoff, one
+ * barrier wait per thread, one message through the pipeline and one round
+ * trip of the echo, as CSV.
+ *
+ * usage: bench_sync [-n ops] [-r read-mostly ops] */
+
+#define WRITE_EVERY 100
+#define HOLD_USECS 20
+
+static long nops = 100000;
+static long nreads = 2000;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run nthreads threads of fn, which do n operations between them, and print
+ * the average time of an operation */
+static void
+bench_run(const char *name, int nthreads, void *(*fn)(void *), long n)
+{
+	Tid tids[nthreads];
+	double start, secs;
+	Tid ret;
+	int ii;
+
+	start = now();
+	for (ii = 0; ii < nthreads; ii++) {
+		tids[ii] = thread_spawn(fn, (void *)(n / nthreads));
+		assert(thread_ret_ok(tids[ii]));
+	}
+	for (ii = 0; ii < nthreads; ii++) {
+		ret = thread_join(tids[ii], NULL);
+		assert(ret == tids[ii]);
+	}
+	secs = now() - start;
+	n = n / nthreads * nthreads;
+	printf("%s,%d,%ld,%.6f,%.1f\n", name, nthreads, n, secs,
+	       secs * 1e9 / n);
+}
+
+static struct rwlock *rw;
+static struct lock *lock;
+static long shared;
+
+static void *
+rw_worker(void *arg)
+{
+	long n = (long)arg;
+	long ii;
+
+	for (ii = 0; ii < n; ii++) {
+		if (ii % WRITE_EVERY == 0) {
+			rwlock_write_acquire(rw);
+			shared++;
+			thread_sleep_for(HOLD_USECS);
+			rwlock_write_release(rw);
+		} else {
+			rwlock_read_acquire(rw);
+			thread_sleep_for(HOLD_USECS);
+			rwlock_read_release(rw);
+		}
+	}
+	return NULL;
+}
+
+static void *
+lock_worker(void *arg)
+{
+	long n = (long)arg;
+	long ii;
+
+	for (ii = 0; ii < n; ii++) {
+		lock_acquire(lock);
+		if (ii % WRITE_EVERY == 0)
+			shared++;
+		thread_sleep_for(HOLD_USECS);
+		lock_release(lock);
+	}
+	return NULL;
+}
+
+static void
+bench_read_mostly(int nthreads)
+{
+	rw = rwlock_create();
+	bench_run("rwlock", nthreads, rw_worker, nreads);
+	rwlock_destroy(rw);
+	lock = lock_create();
+	bench_run("lock", nthreads, lock_worker, nreads);
+	lock_destroy(lock);
+}
+
+static struct semaphore *ping, *pong;
+
+/* wait for the token on ping, and pass it on to pong */
+static void *
+sem_worker(void *arg)
+{
+	long n = (long)arg;
+	long ii;
+
+	for (ii = 0; ii < n; ii++) {
+		semaphore_down(ping);
+		semaphore_up(pong);
+	}
+	return NULL;
+}
+
+static void
+bench_semaphore(void)
+{
+	double start, secs;
+	Tid tid, ret;
+	long ii;
+
+	ping = semaphore_create(0);
+	pong = semaphore_create(0);
+	tid = thread_spawn(sem_worker, (void *)nops);
+	assert(thread_ret_ok(tid));
+	start = now();
+	for (ii = 0; ii < nops; ii++) {
+		semaphore_up(ping);
+		semaphore_down(pong);
+	}
+	secs = now() - start;
+	ret = thread_join(tid, NULL);
+	assert(ret == tid);
+	semaphore_destroy(ping);
+	semaphore_destroy(pong);
+	printf("semaphore,2,%ld,%.6f,%.1f\n", 2 * nops, secs,
+	       secs * 1e9 / (2 * nops));
+}
+
+static struct barrier *barrier;
+static long nrounds;
+
+static void *
+barrier_worker(void *arg)
+{
+	long ii;
+
+	for (ii = 0; ii < nrounds; ii++)
+		barrier_wait(barrier);
+	return NULL;
+}
+
+static void
+bench_barrier(int nthreads)
+{
+	barrier = barrier_create(nthreads);
+	nrounds = nops / nthreads;
+	bench_run("barrier", nthreads, barrier_worker, nops);
+	barrier_destroy(barrier);
+}
+
+#define PIPE_CAPACITY 16
+#define PIPE_MAX_STAGES 8
+
+/* a bounded buffer of the kind that channels replace */
+struct cvbuf {
+	struct lock *lock;
+	struct cv *not_full;
+	struct cv *not_empty;
+	long msgs[PIPE_CAPACITY];
+	int head;
+	int count;
+};
+
+static struct chan *chans[PIPE_MAX_STAGES];
+static struct cvbuf cvbufs[PIPE_MAX_STAGES];
+
+static void
+cvbuf_put(struct cvbuf *b, long v)
+{
+	lock_acquire(b->lock);
+	while (b->count == PIPE_CAPACITY)
+		cv_wait(b->not_full, b->lock);
+	b->msgs[(b->head + b->count++) % PIPE_CAPACITY] = v;
+	cv_signal(b->not_empty, b->lock);
+	lock_release(b->lock);
+}
+
+static long
+cvbuf_get(struct cvbuf *b)
+{
+	long v;
+
+	lock_acquire(b->lock);
+	while (b->count == 0)
+		cv_wait(b->not_empty, b->lock);
+	v = b->msgs[b->head];
+	b->head = (b->head + 1) % PIPE_CAPACITY;
+	b->count--;
+	cv_signal(b->not_full, b->lock);
+	lock_release(b->lock);
+	return v;
+}
+
+/* pass nops messages from stage i - 1 on to stage i */
+static void *
+chan_stage(void *arg)
+{
+	long i = (long)arg;
+	long ii, v;
+
+	for (ii = 0; ii < nops; ii++) {
+		if (i > 0)
+			chan_recv(chans[i - 1], &v);
+		else
+			v = ii;
+		chan_send(chans[i], &v);
+	}
+	return NULL;
+}
+
+static void *
+cvbuf_stage(void *arg)
+{
+	long i = (long)arg;
+	long ii, v;
+
+	for (ii = 0; ii < nops; ii++) {
+		v = i > 0 ? cvbuf_get(&cvbufs[i - 1]) : ii;
+		cvbuf_put(&cvbufs[i], v);
+	}
+	return NULL;
+}
+
+/* run stage 0, which produces the messages, to stage nstages - 1 in threads,
+ * and receive the messages of the last stage */
+static void
+bench_pipeline(const char *name, int nstages, void *(*stage)(void *))
+{
+	Tid tids[nstages];
+	double start, secs;
+	Tid ret;
+	long ii, v;
+	int i;
+
+	start = now();
+	for (i = 0; i < nstages; i++) {
+		tids[i] = thread_spawn(stage, (void *)(long)i);
+		assert(thread_ret_ok(tids[i]));
+	}
+	for (ii = 0; ii < nops; ii++) {
+		if (stage == chan_stage)
+			chan_recv(chans[nstages - 1], &v);
+		else
+			v = cvbuf_get(&cvbufs[nstages - 1]);
+		assert(v == ii);
+	}
+	for (i = 0; i < nstages; i++) {
+		ret = thread_join(tids[i], NULL);
+		assert(ret == tids[i]);
+	}
+	secs = now() - start;
+	printf("%s,%d,%ld,%.6f,%.1f\n", name, nstages + 1, nops, secs,
+	       secs * 1e9 / nops);
+}
+
+/* send each message received on the first connection back on the second */
+static void *
+chan_echo(void *arg)
+{
+	long ii, v;
+
+	for (ii = 0; ii < nops; ii++) {
+		chan_recv(chans[0], &v);
+		chan_send(chans[1], &v);
+	}
+	return NULL;
+}
+
+static void *
+cvbuf_echo(void *arg)
+{
+	long ii;
+
+	for (ii = 0; ii < nops; ii++)
+		cvbuf_put(&cvbufs[1], cvbuf_get(&cvbufs[0]));
+	return NULL;
+}
+
+static void
+bench_echo(const char *name, void *(*echo)(void *))
+{
+	double start, secs;
+	Tid tid, ret;
+	long ii, v;
+
+	tid = thread_spawn(echo, NULL);
+	assert(thread_ret_ok(tid));
+	start = now();
+	for (ii = 0; ii < nops; ii++) {
+		if (echo == chan_echo) {
+			chan_send(chans[0], &ii);
+			chan_recv(chans[1], &v);
+		} else {
+			cvbuf_put(&cvbufs[0], ii);
+			v = cvbuf_get(&cvbufs[1]);
+		}
+		assert(v == ii);
+	}
+	secs = now() - start;
+	ret = thread_join(tid, NULL);
+	assert(ret == tid);
+	printf("%s,2,%ld,%.6f,%.1f\n", name, nops, secs, secs * 1e9 / nops);
+}
+
+/* create the connections between the stages of a pipeline, or destroy them */
+static void
+bench_pipes(int create)
+{
+	int i;
+
+	for (i = 0; i < PIPE_MAX_STAGES; i++) {
+		if (!create) {
+			chan_destroy(chans[i]);
+			lock_destroy(cvbufs[i].lock);
+			cv_destroy(cvbufs[i].not_full);
+			cv_destroy(cvbufs[i].not_empty);
+			continue;
+		}
+		chans[i] = chan_create(sizeof(long), PIPE_CAPACITY);
+		cvbufs[i].lock = lock_create();
+		cvbufs[i].not_full = cv_create();
+		cvbufs[i].not_empty = cv_create();
+		cvbufs[i].head = 0;
+		cvbufs[i].count = 0;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nops = atol(optarg);
+			break;
+		case 'r':
+			nreads = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n ops] [-r read-mostly ops]\n",
+				argv[0]);
+			exit(1);
+		}
+	}
+	thread_init();
+	printf("bench,threads,ops,seconds,ns_per_op\n");
+	bench_read_mostly(1);
+	bench_read_mostly(10);
+	bench_read_mostly(100);
+	bench_semaphore();
+	bench_barrier(2);
+	bench_barrier(10);
+	bench_barrier(100);
+	bench_pipes(1);
+	bench_echo("chan_echo", chan_echo);
+	bench_echo("cvbuf_echo", cvbuf_echo);
+	bench_pipeline("chan", 2, chan_stage);
+	bench_pipeline("cvbuf", 2, cvbuf_stage);
+	bench_pipeline("chan", PIPE_MAX_STAGES, chan_stage);
+	bench_pipeline("cvbuf", PIPE_MAX_STAGES, cvbuf_stage);
+	bench_pipes(0);
+	return 0;
+}
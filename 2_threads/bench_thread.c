@@ -0,0 +1,549 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <x86intrin.h>
+#include "thread.h"
+#include "interrupt.h"
+#include "thread_io.h"
+#include "trace.h"
+
+/* Microbenchmarks of the thread library, to judge scheduler changes by. All
+ * but io are run with a sweep of thread counts up to THREAD_MAX_THREADS:
+ *
+ * yield:     the threads yield to each other, 2 * nyields times in all.
+ * wakeup:    the threads pass a token around a ring, each waking up the next
+ *            one and going to sleep, 2 * nyields times in all.
+ * create:    the threads are created, exit at once and are joined, until
+ *            ncreates have been.
+ * lock:      the threads take turns acquiring a lock, and yield while
+ *            holding it so that the others queue up behind it, until it has
+ *            been acquired nacquires times. The lock is handed off on each
+ *            release.
+ * broadcast: the threads wait on a condition variable that is broadcast
+ *            NROUNDS times.
+ * preempt:   the threads spin, without timer ticks and then with quanta
+ *            from SIG_INTERVAL down to SIG_MIN_INTERVAL, and time the gaps
+ *            in their spinning. The difference is the cost of the ticks.
+ *            Reported as preempt_<quantum>us.
+ * io:        two threads pass a byte back and forth over a socket pair,
+ *            waiting for it in epoll.
+ *
+ * Prints the average time of an operation: a yield, a wakeup and sleep, a
+ * create, exit and join, an acquire and release, the wakeup of one waiter of
+ * a broadcast, a tick, and a pass of the byte. For the lock, fairness
+ * is Jain's index of the number of times each thread acquired it, which is 1
+ * when all of them acquired it equally often. The results are CSV, or JSON
+ * with -j. With -t, the scheduler events of the run are traced, and written
+ * to file.
+ *
+ * usage: bench_thread [-j] [-n yields] [-l acquires] [-c creates]
+ *                     [-t file] */
+
+static long nyields = 1000000;
+static long nacquires = 100000;
+static long ncreates = 100000;
+static int json;
+static char *trace_path;
+
+/* the thread counts of the sweeps. These include the main thread, except
+ * for lock and broadcast, where it only waits for the others. */
+static const int sweep[] = { 2, 10, 100, THREAD_MAX_THREADS - 1 };
+#define NR_SWEEP (sizeof(sweep) / sizeof(sweep[0]))
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* print the result of a bench, which took secs for ops operations. fairness
+ * is left out when it is negative. */
+static void
+report(const char *bench, int nthreads, long ops, double secs,
+       double ns_per_op, double fairness)
+{
+	static int nr_reports;
+
+	if (!json) {
+		printf("%s,%d,%ld,%.6f,%.1f,", bench, nthreads, ops, secs,
+		       ns_per_op);
+		if (fairness >= 0)
+			printf("%.4f", fairness);
+		printf("\n");
+		return;
+	}
+	printf("%s{\"bench\":\"%s\",\"threads\":%d,\"ops\":%ld,"
+	       "\"seconds\":%.6f,\"ns_per_op\":%.1f,\"fairness\":",
+	       nr_reports++ ? ",\n" : "[\n", bench, nthreads, ops, secs,
+	       ns_per_op);
+	if (fairness >= 0)
+		printf("%.4f}", fairness);
+	else
+		printf("null}");
+}
+
+static long yields_each;
+
+/* yield to any other thread, yields_each times */
+static void *
+yielder(void *arg)
+{
+	Tid ret;
+	long ii;
+
+	for (ii = 0; ii < yields_each; ii++) {
+		ret = thread_yield(THREAD_ANY);
+		assert(thread_ret_ok(ret));
+	}
+	return NULL;
+}
+
+static void
+bench_yield(int nthreads)
+{
+	Tid tids[nthreads];
+	double start, secs;
+	Tid ret;
+	int ii;
+
+	yields_each = 2 * nyields / nthreads;
+	for (ii = 1; ii < nthreads; ii++) {
+		tids[ii] = thread_spawn(yielder, NULL);
+		assert(thread_ret_ok(tids[ii]));
+	}
+	start = now();
+	yielder(NULL);
+	for (ii = 1; ii < nthreads; ii++) {
+		ret = thread_join(tids[ii], NULL);
+		assert(ret == tids[ii]);
+	}
+	secs = now() - start;
+	report("yield", nthreads, yields_each * nthreads, secs,
+	       secs * 1e9 / (yields_each * nthreads), -1);
+}
+
+static struct wait_queue *ring[THREAD_MAX_THREADS];
+static int ring_size;
+static long ring_rounds;
+
+/* wake up the next thread of the ring, and wait for the token to come back,
+ * ring_rounds times. The ring starts at thread 0, which has the token. */
+static void *
+ring_pass(void *arg)
+{
+	long me = (long)arg;
+	struct wait_queue *next = ring[(me + 1) % ring_size];
+	long ii;
+	Tid ret;
+
+	for (ii = 0; ii < ring_rounds; ii++) {
+		if (ii > 0 || me > 0) {
+			ret = thread_sleep(ring[me]);
+			assert(thread_ret_ok(ret));
+		}
+		/* the next thread may not have gone to sleep yet */
+		while (thread_wakeup(next, 0) == 0)
+			thread_yield(THREAD_ANY);
+	}
+	/* the token comes back to thread 0 once more */
+	if (me == 0) {
+		ret = thread_sleep(ring[me]);
+		assert(thread_ret_ok(ret));
+	}
+	return NULL;
+}
+
+static void
+bench_wakeup(int nthreads)
+{
+	Tid tids[nthreads];
+	double start, secs;
+	Tid ret;
+	long ii;
+
+	ring_size = nthreads;
+	ring_rounds = 2 * nyields / nthreads;
+	for (ii = 0; ii < nthreads; ii++)
+		ring[ii] = wait_queue_create();
+	for (ii = 1; ii < nthreads; ii++) {
+		tids[ii] = thread_spawn(ring_pass, (void *)ii);
+		assert(thread_ret_ok(tids[ii]));
+	}
+	start = now();
+	ring_pass((void *)0);
+	for (ii = 1; ii < nthreads; ii++) {
+		ret = thread_join(tids[ii], NULL);
+		assert(ret == tids[ii]);
+	}
+	secs = now() - start;
+	for (ii = 0; ii < nthreads; ii++)
+		wait_queue_destroy(ring[ii]);
+	report("wakeup", nthreads, ring_rounds * nthreads, secs,
+	       secs * 1e9 / (ring_rounds * nthreads), -1);
+}
+
+static void *
+exit_at_once(void *arg)
+{
+	return arg;
+}
+
+/* create nthreads - 1 threads at a time, and join them */
+static void
+bench_create(int nthreads)
+{
+	Tid tids[nthreads];
+	double start, secs;
+	long done = 0;
+	Tid ret;
+	int ii;
+
+	start = now();
+	while (done < ncreates) {
+		for (ii = 1; ii < nthreads; ii++) {
+			tids[ii] = thread_spawn(exit_at_once, NULL);
+			assert(thread_ret_ok(tids[ii]));
+		}
+		for (ii = 1; ii < nthreads; ii++) {
+			ret = thread_join(tids[ii], NULL);
+			assert(ret == tids[ii]);
+		}
+		done += nthreads - 1;
+	}
+	secs = now() - start;
+	report("create", nthreads, done, secs, secs * 1e9 / done, -1);
+}
+
+static struct lock *bench_lock;
+static long lock_total;		/* acquires so far, protected by bench_lock */
+
+/* acquire the lock until it has been acquired nacquires times in all, and
+ * return the number of times this thread acquired it */
+static void *
+lock_contend(void *arg)
+{
+	long mine = 0;
+
+	for (;;) {
+		lock_acquire(bench_lock);
+		if (lock_total == nacquires) {
+			lock_release(bench_lock);
+			break;
+		}
+		lock_total++;
+		mine++;
+		thread_yield(THREAD_ANY);
+		lock_release(bench_lock);
+	}
+	return (void *)mine;
+}
+
+static void
+bench_contended_lock(int nthreads)
+{
+	Tid tids[nthreads];
+	double start, secs, sum = 0, sumsq = 0;
+	void *mine;
+	Tid ret;
+	int ii;
+
+	bench_lock = lock_create();
+	lock_total = 0;
+	start = now();
+	for (ii = 0; ii < nthreads; ii++) {
+		tids[ii] = thread_spawn(lock_contend, NULL);
+		assert(thread_ret_ok(tids[ii]));
+	}
+	for (ii = 0; ii < nthreads; ii++) {
+		ret = thread_join(tids[ii], &mine);
+		assert(ret == tids[ii]);
+		sum += (long)mine;
+		sumsq += (double)(long)mine * (long)mine;
+	}
+	secs = now() - start;
+	assert(sum == nacquires);
+	lock_destroy(bench_lock);
+	report("lock", nthreads, nacquires, secs, secs * 1e9 / nacquires,
+	       sum * sum / (nthreads * sumsq));
+}
+
+#define NROUNDS 1000
+
+static struct cv *round_cv;	/* signalled when the next round starts */
+static struct cv *arrived_cv;	/* signalled when all waiters have arrived */
+static long round_nr;
+static int nr_arrived;
+static int nr_waiters;
+
+/* wait for each of NROUNDS broadcasts */
+static void *
+broadcast_waiter(void *arg)
+{
+	long seen;
+
+	lock_acquire(bench_lock);
+	for (seen = 0; seen < NROUNDS; seen++) {
+		if (++nr_arrived == nr_waiters)
+			cv_signal(arrived_cv, bench_lock);
+		while (round_nr == seen)
+			cv_wait(round_cv, bench_lock);
+	}
+	lock_release(bench_lock);
+	return NULL;
+}
+
+static void
+bench_broadcast(int nthreads)
+{
+	Tid tids[nthreads];
+	double start, secs;
+	Tid ret;
+	int ii;
+
+	bench_lock = lock_create();
+	round_cv = cv_create();
+	arrived_cv = cv_create();
+	round_nr = 0;
+	nr_arrived = 0;
+	nr_waiters = nthreads;
+	for (ii = 0; ii < nthreads; ii++) {
+		tids[ii] = thread_spawn(broadcast_waiter, NULL);
+		assert(thread_ret_ok(tids[ii]));
+	}
+	start = now();
+	lock_acquire(bench_lock);
+	while (round_nr < NROUNDS) {
+		while (nr_arrived < nthreads)
+			cv_wait(arrived_cv, bench_lock);
+		nr_arrived = 0;
+		round_nr++;
+		cv_broadcast(round_cv, bench_lock);
+	}
+	lock_release(bench_lock);
+	for (ii = 0; ii < nthreads; ii++) {
+		ret = thread_join(tids[ii], NULL);
+		assert(ret == tids[ii]);
+	}
+	secs = now() - start;
+	cv_destroy(arrived_cv);
+	cv_destroy(round_cv);
+	lock_destroy(bench_lock);
+	report("broadcast", nthreads, (long)NROUNDS * nthreads, secs,
+	       secs * 1e9 / ((long)NROUNDS * nthreads), -1);
+}
+
+static int io_fds[2];
+
+/* read a byte from fd and write it back, nyields times */
+static void *
+io_pingpong(void *arg)
+{
+	int fd = (long)arg;
+	char c = 0;
+	ssize_t n;
+	long ii;
+
+	for (ii = 0; ii < nyields; ii++) {
+		n = thread_read(fd, &c, 1);
+		assert(n == 1);
+		n = thread_write(fd, &c, 1);
+		assert(n == 1);
+	}
+	return NULL;
+}
+
+static void
+bench_io(void)
+{
+	double start, secs;
+	Tid tid, ret;
+	long ii;
+	ssize_t n;
+	char c = 0;
+	int err;
+
+	err = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, io_fds);
+	assert(err == 0);
+	tid = thread_spawn(io_pingpong, (void *)(long)io_fds[1]);
+	assert(thread_ret_ok(tid));
+	start = now();
+	for (ii = 0; ii < nyields; ii++) {
+		n = thread_write(io_fds[0], &c, 1);
+		assert(n == 1);
+		n = thread_read(io_fds[0], &c, 1);
+		assert(n == 1);
+	}
+	secs = now() - start;
+	ret = thread_join(tid, NULL);
+	assert(ret == tid);
+	close(io_fds[0]);
+	close(io_fds[1]);
+	report("io", 2, 2 * nyields, secs, secs * 1e9 / (2 * nyields), -1);
+}
+
+#define PREEMPT_SPINS 20000000L
+/* the quanta, in usecs, down to the shortest that interrupts_quantum takes.
+ * The baseline is run with a quantum longer than the run. */
+static const int preempt_quanta[] = {
+	SIG_INTERVAL, 100, SIG_MIN_INTERVAL
+};
+#define PREEMPT_NO_QUANTUM 10000000	/* usecs */
+/* a gap of more than PREEMPT_GAP TSC cycles between two reads of the TSC by
+ * the spinners is time that they did not run. Gaps of more than
+ * PREEMPT_GAP_MAX are taken to be the host's. */
+#define PREEMPT_GAP 1000
+#define PREEMPT_GAP_MAX 1000000
+
+static unsigned long last_tsc;
+static unsigned long lost_tsc;
+
+/* spin for arg iterations, and count the time lost between them. Since only
+ * one spinner runs at a time, the gaps include the switches from one spinner
+ * to the next. A spinner that is preempted between reading last_tsc and
+ * setting it finds that it changed, and reads the TSC again. */
+static void *
+preempt_spin(void *arg)
+{
+	unsigned long tsc, prev;
+	long ii;
+
+	for (ii = 0; ii < (long)arg; ii++) {
+		do {
+			prev = last_tsc;
+			tsc = __rdtsc();
+		} while (!__atomic_compare_exchange_n(&last_tsc, &prev, tsc, 0,
+						      __ATOMIC_RELAXED,
+						      __ATOMIC_RELAXED));
+		if (tsc - prev > PREEMPT_GAP && tsc - prev < PREEMPT_GAP_MAX)
+			__atomic_fetch_add(&lost_tsc, tsc - prev,
+					   __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/* spin PREEMPT_SPINS iterations in all on nthreads threads, with timer
+ * interrupts every quantum usecs. Returns how long it took, the time lost in
+ * seconds, and the number of ticks. */
+static double
+preempt_run(int nthreads, int quantum, double *lost, unsigned long *ticks)
+{
+	Tid tids[nthreads];
+	unsigned long before, preempts, start_tsc;
+	double start, secs;
+	Tid ret;
+	int ii, enabled;
+
+	interrupts_quantum(quantum);
+	/* the threads must not start spinning before the clock starts */
+	enabled = interrupts_set(0);
+	for (ii = 1; ii < nthreads; ii++) {
+		tids[ii] = thread_spawn(preempt_spin,
+					(void *)(PREEMPT_SPINS / nthreads));
+		assert(thread_ret_ok(tids[ii]));
+	}
+	interrupts_stats(&before, &preempts);
+	start = now();
+	start_tsc = last_tsc = __rdtsc();
+	lost_tsc = 0;
+	interrupts_set(enabled);
+	preempt_spin((void *)(PREEMPT_SPINS / nthreads));
+	for (ii = 1; ii < nthreads; ii++) {
+		ret = thread_join(tids[ii], NULL);
+		assert(ret == tids[ii]);
+	}
+	secs = now() - start;
+	*lost = secs * lost_tsc / (__rdtsc() - start_tsc);
+	interrupts_stats(ticks, &preempts);
+	*ticks -= before;
+	return secs;
+}
+
+/* the time lost per tick is the time lost with a short quantum, less that
+ * lost without ticks, to the exits and joins of the spinners. It is the time
+ * to take the signal, and to switch threads when there is another one to run */
+static void
+bench_preempt(int nthreads)
+{
+	unsigned long ticks, none;
+	double secs, on, off;
+	char name[32];
+	unsigned int ii;
+
+	preempt_run(nthreads, PREEMPT_NO_QUANTUM, &off, &none);
+	for (ii = 0; ii < sizeof(preempt_quanta) / sizeof(preempt_quanta[0]);
+	     ii++) {
+		secs = preempt_run(nthreads, preempt_quanta[ii], &on, &ticks);
+		if (ticks <= none)
+			ticks = none + 1;
+		snprintf(name, sizeof(name), "preempt_%dus", preempt_quanta[ii]);
+		report(name, nthreads, ticks, secs,
+		       (on - off) * 1e9 / (ticks - none), -1);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int ii;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "jn:l:c:t:")) != -1) {
+		switch (opt) {
+		case 'j':
+			json = 1;
+			break;
+		case 'n':
+			nyields = atol(optarg);
+			break;
+		case 'l':
+			nacquires = atol(optarg);
+			break;
+		case 'c':
+			ncreates = atol(optarg);
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-j] [-n yields] [-l acquires] "
+				"[-c creates] [-t file]\n", argv[0]);
+			exit(1);
+		}
+	}
+	thread_init();
+	if (trace_path)
+		trace_start();
+	if (!json)
+		printf("bench,threads,ops,seconds,ns_per_op,fairness\n");
+	for (ii = 0; ii < NR_SWEEP; ii++)
+		bench_yield(sweep[ii]);
+	for (ii = 0; ii < NR_SWEEP; ii++)
+		bench_wakeup(sweep[ii]);
+	for (ii = 0; ii < NR_SWEEP; ii++)
+		bench_create(sweep[ii]);
+	for (ii = 0; ii < NR_SWEEP; ii++)
+		bench_contended_lock(sweep[ii]);
+	for (ii = 0; ii < NR_SWEEP; ii++)
+		bench_broadcast(sweep[ii]);
+	bench_io();
+	/* the other benches run without timer interrupts */
+	register_interrupt_handler(0);
+	for (ii = 0; ii < NR_SWEEP; ii++)
+		bench_preempt(sweep[ii]);
+	if (json)
+		printf("\n]\n");
+	if (trace_path) {
+		trace_stop();
+		if (trace_export(trace_path) < 0) {
+			perror(trace_path);
+			exit(1);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,207 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread.h"
+#include "interrupt.h"
+#include "chan.h"
+
+/* A thread waiting on a channel, on its stack. waiters are kept in the order
+ * they sleep in the wait queue of the channel, so that thread_wakeup wakes up
+ * the first one. */
+struct chan_waiter {
+	void *msg;		/* the message to send, or the buffer to receive */
+	Tid tid;
+	struct chan_waiter *next;
+};
+
+struct chan_waiters {
+	struct chan_waiter *head;
+	struct chan_waiter *tail;
+	struct wait_queue *queue;
+};
+
+/* The messages are kept in a ring buffer of capacity slots. Like the rest of
+ * the library, the state is protected by disabling interrupts. */
+struct chan {
+	size_t size;
+	int capacity;
+	int head;		/* the slot of the oldest message */
+	int count;		/* the number of messages in the buffer */
+	char *buf;
+	struct chan_waiters senders;	/* wait while the buffer is full */
+	struct chan_waiters receivers;	/* wait while it is empty */
+};
+
+struct chan *
+chan_create(size_t size, int capacity)
+{
+	struct chan *ch;
+
+	assert(size > 0 && capacity >= 0);
+	ch = malloc(sizeof(struct chan));
+	assert(ch);
+
+	ch->size = size;
+	ch->capacity = capacity;
+	ch->head = 0;
+	ch->count = 0;
+	ch->buf = malloc(size * capacity);
+	assert(ch->buf || capacity == 0);
+	ch->senders.head = ch->senders.tail = NULL;
+	ch->senders.queue = wait_queue_create();
+	ch->receivers.head = ch->receivers.tail = NULL;
+	ch->receivers.queue = wait_queue_create();
+
+	return ch;
+}
+
+void
+chan_destroy(struct chan *ch)
+{
+	assert(ch != NULL);
+
+	wait_queue_destroy(ch->senders.queue);
+	wait_queue_destroy(ch->receivers.queue);
+	free(ch->buf);
+
+	free(ch);
+}
+
+/* sleep in waiters until another thread has passed on msg */
+static void
+chan_wait(struct chan_waiters *waiters, void *msg)
+{
+	struct chan_waiter me;
+	Tid ret;
+
+	me.msg = msg;
+	me.tid = thread_id();
+	me.next = NULL;
+	if (waiters->tail)
+		waiters->tail->next = &me;
+	else
+		waiters->head = &me;
+	waiters->tail = &me;
+	ret = thread_sleep(waiters->queue);
+	assert(thread_ret_ok(ret));
+}
+
+/* take the first waiter off waiters, once its message has been passed on,
+ * and wake it up */
+static void
+chan_wake(struct chan_waiters *waiters)
+{
+	waiters->head = waiters->head->next;
+	if (waiters->head == NULL)
+		waiters->tail = NULL;
+	thread_wakeup(waiters->queue, 0);
+}
+
+/* take the waiters that were destroyed while they waited off the head of
+ * waiters, so that no message is passed on to or from them */
+static void
+chan_reap(struct chan_waiters *waiters)
+{
+	int nr = wait_queue_reap(waiters->queue);
+
+	while (nr-- > 0)
+		waiters->head = waiters->head->next;
+	if (waiters->head == NULL)
+		waiters->tail = NULL;
+}
+
+/* try to send msg without waiting. returns 1 if it was sent. */
+static int
+chan_put(struct chan *ch, const void *msg)
+{
+	struct chan_waiter *w;
+	Tid tid;
+
+	chan_reap(&ch->receivers);
+	if (ch->receivers.head) {
+		/* the buffer is empty, pass msg on directly */
+		w = ch->receivers.head;
+		memcpy(w->msg, msg, ch->size);
+		tid = w->tid;
+		chan_wake(&ch->receivers);
+		thread_yield(tid);
+		return 1;
+	}
+	if (ch->count == ch->capacity)
+		return 0;
+	memcpy(ch->buf + (ch->head + ch->count) % ch->capacity * ch->size,
+	       msg, ch->size);
+	ch->count++;
+	return 1;
+}
+
+/* try to receive a message into msg without waiting. returns 1 if one was
+ * received. */
+static int
+chan_get(struct chan *ch, void *msg)
+{
+	chan_reap(&ch->senders);
+	if (ch->count > 0) {
+		memcpy(msg, ch->buf + ch->head * ch->size, ch->size);
+		ch->head = (ch->head + 1) % ch->capacity;
+		ch->count--;
+		if (ch->senders.head) {
+			/* the first waiting sender takes the free slot */
+			chan_put(ch, ch->senders.head->msg);
+			chan_wake(&ch->senders);
+		}
+		return 1;
+	}
+	if (ch->senders.head == NULL)
+		return 0;
+	/* a channel without a buffer */
+	memcpy(msg, ch->senders.head->msg, ch->size);
+	chan_wake(&ch->senders);
+	return 1;
+}
+
+void
+chan_send(struct chan *ch, const void *msg)
+{
+	int enabled = interrupts_set(0);
+
+	assert(ch != NULL);
+	if (!chan_put(ch, msg))
+		chan_wait(&ch->senders, (void *)msg);
+	interrupts_set(enabled);
+}
+
+void
+chan_recv(struct chan *ch, void *msg)
+{
+	int enabled = interrupts_set(0);
+
+	assert(ch != NULL);
+	if (!chan_get(ch, msg))
+		chan_wait(&ch->receivers, msg);
+	interrupts_set(enabled);
+}
+
+int
+chan_try_send(struct chan *ch, const void *msg)
+{
+	int enabled = interrupts_set(0);
+	int ret;
+
+	assert(ch != NULL);
+	ret = chan_put(ch, msg);
+	interrupts_set(enabled);
+	return ret;
+}
+
+int
+chan_try_recv(struct chan *ch, void *msg)
+{
+	int enabled = interrupts_set(0);
+	int ret;
+
+	assert(ch != NULL);
+	ret = chan_get(ch, msg);
+	interrupts_set(enabled);
+	return ret;
+}
@@ -0,0 +1,30 @@
+#ifndef _CHAN_H_
+#define _CHAN_H_
+
+#include <stddef.h>
+
+/* A bounded channel, a FIFO queue of fixed-size messages between threads.
+ * Messages are copied in and out. A sender that finds a receiver waiting
+ * copies the message straight into the receiver's buffer and switches to it,
+ * and a receiver that makes room takes the message of the first waiting
+ * sender, so that a message passes through with as few switches as
+ * possible. */
+
+/* create a channel for messages of size bytes, that holds up to capacity of
+ * them. With a capacity of 0, each send waits for a receiver. */
+struct chan *chan_create(size_t size, int capacity);
+/* destroy the channel. no thread may be waiting on it. messages still in it
+ * are dropped. */
+void chan_destroy(struct chan *ch);
+
+/* send the message at msg, waiting for room in the channel if needed. */
+void chan_send(struct chan *ch, const void *msg);
+/* receive a message into msg, waiting for one if needed. */
+void chan_recv(struct chan *ch, void *msg);
+
+/* like chan_send and chan_recv, but return 0 instead of waiting, and 1
+ * otherwise. */
+int chan_try_send(struct chan *ch, const void *msg);
+int chan_try_recv(struct chan *ch, void *msg);
+
+#endif /* _CHAN_H_ */
@@ -1,20 +1,115 @@
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <ucontext.h>
 #include <unistd.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/time.h>
 #include <stdarg.h>
 #include "thread.h"
 #include "interrupt.h"
 
+/* older C libraries do not name this field */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 static void interrupt_handler(int sig, siginfo_t * sip, void *contextVP);
 static void set_interrupt();
-static void set_signal(sigset_t * setp);
+static void clear_interrupt();
 
 static int loud = 0;
 
+/* Interrupts are disabled in software, without changing the signal mask.
+ * When SIG_TYPE arrives while interrupts are disabled, interrupt_handler()
+ * only records that a preemption is pending, and the preemption happens when
+ * interrupts are enabled again. The handler runs with SIG_TYPE blocked until
+ * it has disabled interrupts, and blocks it again before it enables them on
+ * its way out, so that sigreturn unblocks it. A tick that arrives in between
+ * only marks a preemption pending, so the handler nests at most once, however
+ * short the quantum.
+ *
+ * Each kernel thread running threads (see thread_set_vps) has its own state
+ * and its own timer. When there is more than one, disabling interrupts also
+ * takes a global lock, like cli() on early SMP kernels, so that code that
+ * disables interrupts also excludes the other kernel threads.
+ *
+ * The timer is periodic, so the handler does not have to set it again on
+ * every tick. It is stopped while no other thread is READY, since there is
+ * nothing to preempt the running thread for, and started again when a thread
+ * becomes READY (see interrupts_start). */
+struct intr_state {
+	volatile sig_atomic_t enabled;
+	volatile sig_atomic_t pending;
+	/* interrupt_handler() runs on this kernel thread, other than in a
+	 * thread it preempted for */
+	volatile sig_atomic_t handling;
+	int created;	/* timer has been created */
+	int armed;	/* the timer is running */
+	int period;	/* the quantum the timer was set to, in usecs */
+	timer_t timer;
+};
+
+static __thread struct intr_state intr_tls = { 1, 0, 0, 0, 0, 0 };
+static int quantum = SIG_INTERVAL;
+static unsigned long nr_ticks;
+static unsigned long nr_preempts;
+static int registered;
+static int smp;
+static int big_lock;
+static sigset_t intr_mask;	/* just SIG_TYPE */
+
+/* returns the state of the calling kernel thread. noipa keeps the compiler
+ * from reusing an earlier result, since a thread can be switched to another
+ * kernel thread in between. */
+static struct intr_state *intr_self(void) __attribute__((noipa));
+
+static struct intr_state *
+intr_self(void)
+{
+	return &intr_tls;
+}
+
+/* A thread that is preempted between getting intr_self() and using it can
+ * resume on another kernel thread, and would then change the flags of the one
+ * it left. The flags are accessed with INTR() instead, in a single instruction
+ * relative to %fs, at an offset from the thread pointer that is the same in
+ * every kernel thread. */
+static long intr_offset;
+#define INTR(field) \
+	(((volatile struct intr_state __seg_fs *)intr_offset)->field)
+
+static void __attribute__((constructor))
+intr_init(void)
+{
+	intr_offset = (char *)&intr_tls - (char *)__builtin_thread_pointer();
+}
+
+static void
+big_lock_acquire(void)
+{
+	int spins = 0;
+
+	while (__atomic_exchange_n(&big_lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&big_lock, __ATOMIC_RELAXED)) {
+			/* the holder may not be running */
+			if (++spins % 128 == 0)
+				sched_yield();
+			else
+				__builtin_ia32_pause();
+		}
+	}
+}
+
+static void
+big_lock_release(void)
+{
+	__atomic_store_n(&big_lock, 0, __ATOMIC_RELEASE);
+}
+
 /* Should be called when you initialize threads package. Many of the calls won't
  * make sense at first -- study the man pages! */
 void
@@ -29,19 +124,75 @@ register_interrupt_handler(int verbose)
 	loud = verbose;
 	action.sa_handler = NULL;
 	action.sa_sigaction = interrupt_handler;
-	/* SIG_TYPE will be blocked while interrupt_handler() is running. */
 	error = sigemptyset(&action.sa_mask);
 	assert(!error);
 
-	/* use sa_sigaction as handler instead of sa_handler */
+	/* use sa_sigaction as handler instead of sa_handler. SIG_TYPE is
+	 * blocked when interrupt_handler() starts, and it unblocks it before
+	 * it may switch to a thread that does not return through it. */
 	action.sa_flags = SA_SIGINFO;
+	error = sigemptyset(&intr_mask);
+	assert(!error);
+	error = sigaddset(&intr_mask, SIG_TYPE);
+	assert(!error);
 	if (sigaction(SIG_TYPE, &action, NULL)) {
 		perror("Setting up signal handler");
 		assert(0);
 	}
+	registered = 1;
 	set_interrupt();
 }
 
+void
+interrupts_start(void)
+{
+	if (registered && !intr_self()->armed)
+		set_interrupt();
+}
+
+void
+interrupts_smp(void)
+{
+	assert(interrupts_enabled());
+	smp = 1;
+}
+
+int
+interrupts_quantum(int usecs)
+{
+	int ret = quantum;
+
+	if (usecs <= 0)
+		return -1;
+	if (usecs < SIG_MIN_INTERVAL)
+		usecs = SIG_MIN_INTERVAL;
+	/* the timers of the other kernel threads change on their next tick */
+	quantum = usecs;
+	if (intr_self()->armed)
+		set_interrupt();
+	return ret;
+}
+
+void
+interrupts_stats(unsigned long *ticks, unsigned long *preempts)
+{
+	*ticks = __atomic_load_n(&nr_ticks, __ATOMIC_RELAXED);
+	*preempts = __atomic_load_n(&nr_preempts, __ATOMIC_RELAXED);
+}
+
+/* let the scheduler preempt the running thread, with interrupts disabled */
+static void
+preempt(void)
+{
+	int ret = thread_preempt();
+
+	if (ret > 0)
+		__atomic_fetch_add(&nr_preempts, 1, __ATOMIC_RELAXED);
+	else if (ret < 0 && !loud)
+		/* keep ticking in verbose mode, to show the handler output */
+		clear_interrupt();
+}
+
 /* enables interrupts. */
 int
 interrupts_on()
@@ -57,32 +208,42 @@ interrupts_off()
 }
 
 /* enables or disables interrupts, and returns whether interrupts were enabled
- * or not previously. */
+ * or not previously. a preemption that was deferred while interrupts were
+ * disabled happens here. */
 int
 interrupts_set(int enabled)
 {
-	int ret;
-	sigset_t mask, omask;
+	int ret = INTR(enabled);
 
-	set_signal(&mask);
-	if (enabled) {
-		ret = sigprocmask(SIG_UNBLOCK, &mask, &omask);
-	} else {
-		ret = sigprocmask(SIG_BLOCK, &mask, &omask);
+	/* keep the compiler from moving memory accesses across the flag */
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	if (!enabled && ret) {
+		/* we may have been preempted, and moved, since reading ret,
+		 * but interrupts are enabled wherever we are now */
+		INTR(enabled) = 0;
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		if (smp)
+			big_lock_acquire();
+	} else if (enabled && !ret) {
+		/* a tick that arrives after this check is taken on the next
+		 * one, since the timer is periodic */
+		if (INTR(pending)) {
+			INTR(pending) = 0;
+			preempt();
+		}
+		if (smp)
+			big_lock_release();
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		INTR(enabled) = 1;
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
 	}
-	assert(!ret);
-	return (sigismember(&omask, SIG_TYPE) ? 0 : 1);
+	return ret;
 }
 
 int
 interrupts_enabled()
 {
-	sigset_t mask;
-	int ret;
-
-	ret = sigprocmask(0, NULL, &mask);
-	assert(!ret);
-	return (sigismember(&mask, SIG_TYPE) ? 0 : 1);
+	return INTR(enabled);
 }
 
 void
@@ -126,20 +287,19 @@ unintr_printf(const char *fmt, ...)
 
 /* static functions */
 
+static int first = 1;
+static struct timeval start, end, diff = { 0, 0 };
+
+/* preempt from interrupt_handler(). the thread switched to may run outside of
+ * the handler, on this kernel thread, until it switches back */
 static void
-set_signal(sigset_t * setp)
+handler_preempt(void)
 {
-	int ret;
-	ret = sigemptyset(setp);
-	assert(!ret);
-	ret = sigaddset(setp, SIG_TYPE);
-	assert(!ret);
-	return;
+	INTR(handling) = 0;
+	preempt();
+	INTR(handling) = 1;
 }
 
-static int first = 1;
-static struct timeval start, end, diff = { 0, 0 };
-
 /*
  * STUB: once register_interrupt_handler() is called, this routine
  * gets called each time SIG_TYPE is sent to this process
@@ -148,9 +308,22 @@ static void
 interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
 {
 	ucontext_t *context = (ucontext_t *) contextVP;
+	struct intr_state *s = intr_self();
 
-	/* check that SIG_TYPE is blocked on entry */
-	assert(!interrupts_enabled());
+	__atomic_fetch_add(&nr_ticks, 1, __ATOMIC_RELAXED);
+	if (s->period != quantum)
+		set_interrupt();
+	if (!s->enabled) {
+		/* preempt when interrupts are enabled again */
+		s->pending = 1;
+		return;
+	}
+	/* a tick can only nest in the handler while interrupts are disabled */
+	assert(!s->handling);
+	interrupts_set(0);
+	INTR(handling) = 1;
+	/* a tick that arrives from now on only marks a preemption pending */
+	pthread_sigmask(SIG_UNBLOCK, &intr_mask, NULL);
 	if (loud) {
 		int ret;
 		ret = gettimeofday(&end, NULL);
@@ -165,27 +338,67 @@ interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
 		       __FUNCTION__, context,
 		       diff.tv_sec * 1000000 + diff.tv_usec);
 	}
-	set_interrupt();
-	/* implement preemptive threading by calling thread_yield */
-	thread_yield(THREAD_ANY);
+	/* implement preemptive threading by letting the scheduler pick a
+	 * thread to run */
+	handler_preempt();
+	/* enable interrupts like interrupts_set(1), but with SIG_TYPE blocked,
+	 * since a tick taken before sigreturn would nest in this frame. a tick
+	 * that arrives after the check is taken on the next one. */
+	if (INTR(pending)) {
+		INTR(pending) = 0;
+		handler_preempt();
+	}
+	pthread_sigmask(SIG_BLOCK, &intr_mask, NULL);
+	/* only now, so that the assert above covers all of the handler */
+	INTR(handling) = 0;
+	if (smp)
+		big_lock_release();
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	INTR(enabled) = 1;
 }
 
 /*
- * Use the setitimer() system call to set an alarm in the future. At that time,
- * this process will receive a SIGALRM signal.
+ * Start a periodic alarm, using a timer that delivers SIG_TYPE to the calling
+ * kernel thread, so that each kernel thread running threads is preempted on
+ * its own.
  */
 static void
 set_interrupt()
 {
+	struct intr_state *s = intr_self();
+	struct itimerspec val;
+	struct sigevent sev;
 	int ret;
-	struct itimerval val;
 
-	val.it_interval.tv_sec = 0;
-	val.it_interval.tv_usec = 0;
+	if (!s->created) {
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev.sigev_signo = SIG_TYPE;
+		sev.sigev_value.sival_ptr = NULL;
+		sev.sigev_notify_thread_id = gettid();
+		ret = timer_create(CLOCK_MONOTONIC, &sev, &s->timer);
+		assert(!ret);
+		s->created = 1;
+	}
+	s->period = quantum;
+	s->armed = 1;
+
+	val.it_interval.tv_sec = s->period / 1000000;
+	val.it_interval.tv_nsec = s->period % 1000000 * 1000;
+	val.it_value = val.it_interval;
 
-	val.it_value.tv_sec = 0;
-	val.it_value.tv_usec = SIG_INTERVAL;
+	ret = timer_settime(s->timer, 0, &val, NULL);
+	assert(!ret);
+}
+
+/* stop the alarm of the calling kernel thread */
+static void
+clear_interrupt()
+{
+	struct intr_state *s = intr_self();
+	struct itimerspec val = { { 0, 0 }, { 0, 0 } };
+	int ret;
 
-	ret = setitimer(ITIMER_REAL, &val, NULL);
+	ret = timer_settime(s->timer, 0, &val, NULL);
 	assert(!ret);
+	s->armed = 0;
 }
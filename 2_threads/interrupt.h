@@ -12,10 +12,28 @@
 
 /* we will use this signal type for delivering "interrupts". */
 #define SIG_TYPE SIGALRM
-/* the interrupt will be delivered every 200 usec */
+/* by default, the interrupt will be delivered every 200 usec */
 #define SIG_INTERVAL 200
+/* the shortest quantum. Taking a tick that preempts takes 5-10 usecs, so
+ * with shorter quanta the threads would spend most of their time in it. */
+#define SIG_MIN_INTERVAL 50
 
 void register_interrupt_handler(int verbose);
+/* start the timer of the calling kernel thread, if the interrupt handler has
+ * been registered and the timer is not running yet */
+void interrupts_start(void);
+/* called before starting more kernel threads that run threads, see
+ * thread_set_vps */
+void interrupts_smp(void);
+/* set the time between interrupts to usecs, or to SIG_MIN_INTERVAL if usecs
+ * is shorter. returns the previous value, or -1 if usecs is not positive. */
+int interrupts_quantum(int usecs);
+/* the number of interrupts so far, and how many of them switched threads */
+void interrupts_stats(unsigned long *ticks, unsigned long *preempts);
+/* called on each timer interrupt, in thread.c. returns 1 if it switched to
+ * another thread, 0 if the running thread keeps running, and -1 if no other
+ * thread is READY, so the timer can be stopped. */
+int thread_preempt(void);
 int interrupts_on(void);
 int interrupts_off(void);
 int interrupts_set(int enabled);
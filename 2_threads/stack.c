@@ -0,0 +1,45 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stack.h"
+
+static void *cache[STACK_CACHE_SIZE];
+static int nr_cached;
+static long page_size;
+
+void *
+stack_alloc(void)
+{
+	char *map;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_POPULATE;
+
+	if (nr_cached > 0)
+		return cache[--nr_cached];
+
+	if (page_size == 0)
+		page_size = sysconf(_SC_PAGESIZE);
+	map = mmap(NULL, page_size + STACK_SIZE, PROT_READ | PROT_WRITE, flags,
+		   -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	/* the guard page */
+	if (mprotect(map, page_size, PROT_NONE) < 0) {
+		munmap(map, page_size + STACK_SIZE);
+		return NULL;
+	}
+	return map + page_size;
+}
+
+void
+stack_free(void *stack)
+{
+	int ret;
+
+	if (nr_cached < STACK_CACHE_SIZE) {
+		cache[nr_cached++] = stack;
+		return;
+	}
+	ret = munmap((char *)stack - page_size, page_size + STACK_SIZE);
+	assert(!ret);
+}
@@ -0,0 +1,21 @@
+#ifndef _STACK_H_
+#define _STACK_H_
+
+#include "thread.h"
+
+/* Thread stacks. Each stack is mapped with mmap, with an inaccessible guard
+ * page below it, so that a thread that overflows its stack faults instead of
+ * overwriting other memory. All its pages are allocated when it is mapped, so
+ * that running threads do not take page faults. Freed stacks are kept in a cache of up to
+ * STACK_CACHE_SIZE stacks, and reused by later allocations. */
+#define STACK_SIZE THREAD_MIN_STACK
+#define STACK_CACHE_SIZE 64
+
+/* returns the lowest address of a new STACK_SIZE byte stack, or NULL when out
+ * of memory. */
+void *stack_alloc(void);
+
+/* release a stack returned by stack_alloc */
+void stack_free(void *stack);
+
+#endif /* _STACK_H_ */
@@ -0,0 +1,251 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "thread.h"
+#include "interrupt.h"
+#include "sync.h"
+
+/* The state of each primitive is protected by disabling interrupts, as in
+ * thread.c. thread_sleep is called with interrupts disabled, so that no
+ * wakeup can be missed between checking the state and going to sleep, and
+ * returns with them still disabled. The waiters that were destroyed while
+ * they slept are reaped before handing anything over to the others. */
+
+/* suspend the calling thread in queue until it is woken up. Another thread
+ * must be able to wake it up, or it would never return. */
+static void
+sync_sleep(struct wait_queue *queue)
+{
+	Tid ret;
+
+	ret = thread_sleep(queue);
+	assert(thread_ret_ok(ret));
+}
+
+struct rwlock {
+	int readers;		/* the number of readers that hold the lock */
+	int writer;		/* whether a writer holds the lock */
+	int nr_writers;		/* the number of writers in writeq */
+	struct wait_queue *readq;
+	struct wait_queue *writeq;
+};
+
+struct rwlock *
+rwlock_create()
+{
+	struct rwlock *rw;
+
+	rw = malloc(sizeof(struct rwlock));
+	assert(rw);
+
+	rw->readers = 0;
+	rw->writer = 0;
+	rw->nr_writers = 0;
+	rw->readq = wait_queue_create();
+	rw->writeq = wait_queue_create();
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	assert(rw != NULL);
+
+	assert(rw->readers == 0 && !rw->writer);
+	wait_queue_destroy(rw->readq);
+	wait_queue_destroy(rw->writeq);
+
+	free(rw);
+}
+
+/* admit the readers that wait as one batch */
+static void
+rwlock_readers(struct rwlock *rw)
+{
+	wait_queue_reap(rw->readq);
+	rw->readers = thread_wakeup(rw->readq, 1);
+}
+
+/* give the lock, which no thread holds, to the next writer, if one waits */
+static void
+rwlock_next_writer(struct rwlock *rw)
+{
+	rw->nr_writers -= wait_queue_reap(rw->writeq);
+	if (rw->nr_writers == 0) {
+		/* the readers may have waited for writers that were
+		 * destroyed */
+		rwlock_readers(rw);
+		return;
+	}
+	rw->nr_writers--;
+	rw->writer = 1;
+	thread_wakeup(rw->writeq, 0);
+}
+
+void
+rwlock_read_acquire(struct rwlock *rw)
+{
+	int enabled = interrupts_set(0);
+
+	assert(rw != NULL);
+	if (rw->writer || rw->nr_writers > 0) {
+		/* the writer that releases the lock admits us */
+		sync_sleep(rw->readq);
+	} else {
+		rw->readers++;
+	}
+	interrupts_set(enabled);
+}
+
+void
+rwlock_read_release(struct rwlock *rw)
+{
+	int enabled = interrupts_set(0);
+
+	assert(rw != NULL);
+	assert(rw->readers > 0 && !rw->writer);
+	if (--rw->readers == 0)
+		rwlock_next_writer(rw);
+	interrupts_set(enabled);
+}
+
+void
+rwlock_write_acquire(struct rwlock *rw)
+{
+	int enabled = interrupts_set(0);
+
+	assert(rw != NULL);
+	if (rw->writer || rw->readers > 0) {
+		/* the last thread to release the lock hands it to us */
+		rw->nr_writers++;
+		sync_sleep(rw->writeq);
+		assert(rw->writer);
+	} else {
+		rw->writer = 1;
+	}
+	interrupts_set(enabled);
+}
+
+void
+rwlock_write_release(struct rwlock *rw)
+{
+	int enabled = interrupts_set(0);
+
+	assert(rw != NULL);
+	assert(rw->writer);
+	rw->writer = 0;
+	/* admit the readers that wait ahead of the writers */
+	rwlock_readers(rw);
+	if (rw->readers == 0)
+		rwlock_next_writer(rw);
+	interrupts_set(enabled);
+}
+
+struct semaphore {
+	long count;
+	struct wait_queue *waiters;
+};
+
+struct semaphore *
+semaphore_create(long count)
+{
+	struct semaphore *sem;
+
+	assert(count >= 0);
+	sem = malloc(sizeof(struct semaphore));
+	assert(sem);
+
+	sem->count = count;
+	sem->waiters = wait_queue_create();
+
+	return sem;
+}
+
+void
+semaphore_destroy(struct semaphore *sem)
+{
+	assert(sem != NULL);
+
+	wait_queue_destroy(sem->waiters);
+
+	free(sem);
+}
+
+void
+semaphore_down(struct semaphore *sem)
+{
+	int enabled = interrupts_set(0);
+
+	assert(sem != NULL);
+	if (sem->count > 0) {
+		sem->count--;
+	} else {
+		/* semaphore_up passes its increment on to us */
+		sync_sleep(sem->waiters);
+	}
+	interrupts_set(enabled);
+}
+
+void
+semaphore_up(struct semaphore *sem)
+{
+	int enabled = interrupts_set(0);
+
+	assert(sem != NULL);
+	wait_queue_reap(sem->waiters);
+	if (thread_wakeup(sem->waiters, 0) == 0)
+		sem->count++;
+	interrupts_set(enabled);
+}
+
+struct barrier {
+	int count;		/* the number of threads to wait for */
+	int arrived;		/* the number that have arrived so far */
+	struct wait_queue *waiters;
+};
+
+struct barrier *
+barrier_create(int count)
+{
+	struct barrier *b;
+
+	assert(count > 0);
+	b = malloc(sizeof(struct barrier));
+	assert(b);
+
+	b->count = count;
+	b->arrived = 0;
+	b->waiters = wait_queue_create();
+
+	return b;
+}
+
+void
+barrier_destroy(struct barrier *b)
+{
+	assert(b != NULL);
+
+	assert(b->arrived == 0);
+	wait_queue_destroy(b->waiters);
+
+	free(b);
+}
+
+int
+barrier_wait(struct barrier *b)
+{
+	int enabled = interrupts_set(0);
+	int last;
+
+	assert(b != NULL);
+	last = ++b->arrived == b->count;
+	if (last) {
+		/* start the next round before the others run */
+		b->arrived = 0;
+		thread_wakeup(b->waiters, 1);
+	} else {
+		sync_sleep(b->waiters);
+	}
+	interrupts_set(enabled);
+	return last;
+}
@@ -0,0 +1,49 @@
+#ifndef _SYNC_H_
+#define _SYNC_H_
+
+/* Synchronization primitives built on the wait queues of thread.h. Like the
+ * lock, each one hands itself over to the threads it wakes up, so a thread
+ * that wakes up never has to check again whether it may go on. */
+
+/* create a reader-writer lock. any number of readers, or one writer, can hold
+ * it at a time. A reader that arrives while a writer holds the lock or waits
+ * for it waits too, so that writers do not starve. When a writer releases the
+ * lock, it admits all the readers that wait at that time together, before the
+ * next writer, so that readers do not starve either. */
+struct rwlock *rwlock_create();
+/* destroy the reader-writer lock, which must not be held. */
+void rwlock_destroy(struct rwlock *rw);
+
+/* acquire the lock for reading. */
+void rwlock_read_acquire(struct rwlock *rw);
+/* release the lock, which the calling thread has acquired for reading. */
+void rwlock_read_release(struct rwlock *rw);
+/* acquire the lock for writing. */
+void rwlock_write_acquire(struct rwlock *rw);
+/* release the lock, which the calling thread has acquired for writing. */
+void rwlock_write_release(struct rwlock *rw);
+
+/* create a counting semaphore with the initial value count, which must not be
+ * negative. */
+struct semaphore *semaphore_create(long count);
+/* destroy the semaphore. no thread may be waiting on it. */
+void semaphore_destroy(struct semaphore *sem);
+
+/* wait until the value of the semaphore is positive, and decrement it. */
+void semaphore_down(struct semaphore *sem);
+/* increment the value of the semaphore, or wake up the first waiting thread
+ * instead, if there is one. */
+void semaphore_up(struct semaphore *sem);
+
+/* create a barrier for count threads, which must be positive. */
+struct barrier *barrier_create(int count);
+/* destroy the barrier. no thread may be waiting on it. */
+void barrier_destroy(struct barrier *b);
+
+/* wait until count threads have called barrier_wait, and then let all of them
+ * go on. The barrier can then be used again. Returns 1 in the last thread to
+ * arrive, and 0 in the others. A thread that is destroyed while it waits
+ * still counts as having arrived. */
+int barrier_wait(struct barrier *b);
+
+#endif /* _SYNC_H_ */
@@ -0,0 +1,10 @@
+#include "thread.h"
+#include "test_thread.h"
+
+int
+main(int argc, char **argv)
+{
+	thread_init();
+	test_join();
+	return 0;
+}
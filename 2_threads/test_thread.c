@@ -1,8 +1,17 @@
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
 #include "thread.h"
 #include "interrupt.h"
+#include "sync.h"
+#include "chan.h"
+#include "thread_io.h"
+#include "trace.h"
 #include "test_thread.h"
 
 #define DURATION  60000000
@@ -706,3 +715,1166 @@ test_cv_broadcast()
 	assert(interrupts_enabled());	
 	unintr_printf("cv broadcast test done\n");
 }
+
+#define NVPS 4
+
+static struct wait_queue *vps_queue;
+static long vps_counter;
+/* the kernel thread each thread last ran on */
+static pid_t vps_ktid[NTHREADS];
+
+static void
+test_vps_thread(unsigned long num)
+{
+	int i, j, enabled;
+	long val;
+	Tid ret;
+
+	for (i = 0; i < LOOPS; i++) {
+		for (j = 0; j < NLOCKLOOPS; j++) {
+			/* disabling interrupts also excludes the threads on the
+			 * other VPs */
+			enabled = interrupts_off();
+			assert(enabled);
+			val = vps_counter;
+			vps_counter = val + 1;
+			interrupts_set(enabled);
+			/* work that can run in parallel */
+			spin(2);
+
+			ret = thread_yield(THREAD_ANY);
+			assert(thread_ret_ok(ret) || ret == THREAD_NONE);
+		}
+		/* sleep until the initial thread wakes us up, maybe on
+		 * another VP */
+		enabled = interrupts_off();
+		ret = thread_sleep(vps_queue);
+		assert(thread_ret_ok(ret));
+		interrupts_set(enabled);
+		vps_ktid[num] = gettid();
+	}
+	__sync_fetch_and_add(&done, 1);
+}
+
+void
+test_vps()
+{
+	long i, j;
+	int ret;
+
+	unintr_printf("starting vps test\n");
+	ret = thread_set_vps(NVPS);
+	assert(ret == NVPS);
+	ret = thread_set_vps(NVPS);
+	assert(ret == THREAD_INVALID);
+
+	vps_queue = wait_queue_create();
+	done = 0;
+	for (i = 0; i < NTHREADS; i++) {
+		ret = thread_create((void (*)(void *))test_vps_thread,
+				    (void *)i);
+		assert(thread_ret_ok(ret));
+	}
+	while (__sync_fetch_and_add(&done, 0) < NTHREADS) {
+		thread_wakeup(vps_queue, 1);
+		thread_yield(THREAD_ANY);
+	}
+	assert(vps_counter == NTHREADS * LOOPS * NLOCKLOOPS);
+
+	/* the threads ran on more than one kernel thread */
+	for (i = 1, j = 0; i < NTHREADS; i++) {
+		if (vps_ktid[i] != vps_ktid[0])
+			j++;
+	}
+	assert(j > 0);
+	wait_queue_destroy(vps_queue);
+	unintr_printf("vps test done\n");
+}
+
+/* priority test */
+
+#define NPRIO 3
+
+static int prio_order[NPRIO];
+static int nr_prio_done;
+static int prio_spinning;
+
+static void
+test_priority_thread(unsigned long num)
+{
+	int enabled = interrupts_off();
+
+	prio_order[nr_prio_done++] = num;
+	interrupts_set(enabled);
+}
+
+/* keep the timer running, at the lowest priority */
+static void
+test_priority_spinner(void *arg)
+{
+	while (__sync_fetch_and_add(&prio_spinning, 0))
+		;
+}
+
+/* spin until the priority of the calling thread satisfies cond, or for at
+ * most a second. returns whether cond was satisfied. */
+static int
+wait_priority(int (*cond)(int prio))
+{
+	struct timeval start, end, diff;
+
+	gettimeofday(&start, NULL);
+	do {
+		if (cond(thread_get_priority(THREAD_SELF)))
+			return 1;
+		gettimeofday(&end, NULL);
+		timersub(&end, &start, &diff);
+	} while (diff.tv_sec == 0);
+	return 0;
+}
+
+static int
+is_demoted(int prio)
+{
+	return prio > 0;
+}
+
+static int
+is_boosted(int prio)
+{
+	return prio == 0;
+}
+
+void
+test_priority()
+{
+	/* the threads get these priorities, so they run in reverse order */
+	static const int prio[NPRIO] = { 2, 1, 0 };
+	Tid tids[NPRIO];
+	int enabled, ret;
+	long i;
+
+	unintr_printf("starting priority test\n");
+	assert(thread_get_priority(THREAD_SELF) == 0);
+	assert(thread_set_priority(THREAD_SELF, -1) == THREAD_INVALID);
+	assert(thread_set_priority(THREAD_SELF, THREAD_PRIO_LEVELS) ==
+	       THREAD_INVALID);
+	assert(thread_set_priority(THREAD_MAX_THREADS - 1, 0) ==
+	       THREAD_INVALID);
+	assert(thread_get_priority(THREAD_MAX_THREADS - 1) == THREAD_INVALID);
+
+	/* READY threads run in priority order */
+	enabled = interrupts_off();
+	for (i = 0; i < NPRIO; i++) {
+		tids[i] = thread_create((void (*)(void *))test_priority_thread,
+					(void *)i);
+		assert(thread_ret_ok(tids[i]));
+		ret = thread_set_priority(tids[i], prio[i]);
+		assert(ret == 0);
+		assert(thread_get_priority(tids[i]) == prio[i]);
+	}
+	interrupts_set(enabled);
+	while (__sync_fetch_and_add(&nr_prio_done, 0) < NPRIO)
+		thread_yield(THREAD_ANY);
+	for (i = 0; i < NPRIO; i++)
+		assert(prio_order[i] == NPRIO - 1 - i);
+
+	/* a thread that keeps running moves down, and is boosted back up */
+	prio_spinning = 1;
+	ret = thread_create(test_priority_spinner, NULL);
+	assert(thread_ret_ok(ret));
+	ret = thread_set_priority(ret, THREAD_PRIO_LEVELS - 1);
+	assert(ret == 0);
+	ret = wait_priority(is_demoted);
+	assert(ret);
+	ret = wait_priority(is_boosted);
+	assert(ret);
+	__sync_fetch_and_sub(&prio_spinning, 1);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	unintr_printf("priority test done\n");
+}
+
+/* timer test */
+
+#define TIMER_SPIN 100000
+
+static int timer_spinning;
+static long timer_spins[3];
+
+static void
+test_timer_spinner(void *arg)
+{
+	while (__sync_fetch_and_add(&timer_spinning, 0))
+		;
+}
+
+static void
+test_timer_counter(void *arg)
+{
+	long num = (long)arg;
+
+	while (__sync_fetch_and_add(&timer_spinning, 0))
+		timer_spins[num]++;
+}
+
+/* spin for TIMER_SPIN usecs, and return the number of ticks in between */
+static unsigned long
+timer_ticks(unsigned long *preempts)
+{
+	unsigned long ticks0, preempts0, ticks;
+
+	interrupts_stats(&ticks0, &preempts0);
+	spin(TIMER_SPIN);
+	interrupts_stats(&ticks, preempts);
+	*preempts -= preempts0;
+	return ticks - ticks0;
+}
+
+void
+test_timer()
+{
+	unsigned long ticks, preempts;
+	long i;
+	int ret;
+
+	unintr_printf("starting timer test\n");
+	assert(interrupts_quantum(0) == -1);
+
+	/* the timer stops when no other thread is READY */
+	ticks = timer_ticks(&preempts);
+	assert(ticks <= 2 && preempts == 0);
+
+	/* and starts again when there is one */
+	timer_spinning = 1;
+	ret = thread_create(test_timer_spinner, NULL);
+	assert(thread_ret_ok(ret));
+	ticks = timer_ticks(&preempts);
+	assert(ticks > TIMER_SPIN / SIG_INTERVAL / 4 && preempts > 0);
+
+	/* a longer quantum gives fewer ticks */
+	ret = interrupts_quantum(SIG_INTERVAL * 10);
+	assert(ret == SIG_INTERVAL);
+	ticks = timer_ticks(&preempts);
+	assert(ticks > 0 && ticks <= TIMER_SPIN / SIG_INTERVAL / 10 + 2);
+	ret = interrupts_quantum(SIG_INTERVAL);
+	assert(ret == SIG_INTERVAL * 10);
+
+	/* a shorter quantum than the minimum gives the minimum, at which the
+	 * threads are still preempted and get to run. the handler asserts that
+	 * no tick nests in it while it has interrupts enabled. */
+	for (i = 0; i < 3; i++) {
+		ret = thread_create(test_timer_counter, (void *)i);
+		assert(thread_ret_ok(ret));
+	}
+	ret = interrupts_quantum(1);
+	assert(ret == SIG_INTERVAL);
+	ticks = timer_ticks(&preempts);
+	assert(ticks > TIMER_SPIN / SIG_INTERVAL && preempts > 0);
+	ret = interrupts_quantum(SIG_INTERVAL);
+	assert(ret == SIG_MIN_INTERVAL);
+	for (i = 0; i < 3; i++)
+		assert(timer_spins[i] > 0);
+
+	__sync_fetch_and_sub(&timer_spinning, 1);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	unintr_printf("timer test done\n");
+}
+
+/* join test */
+
+#define NJOIN 8
+
+static struct wait_queue *join_queue;
+static Tid join_target;
+
+/* returns a value that depends on arg, after letting the others run */
+static void *
+test_join_square(void *arg)
+{
+	long num = (long)arg;
+	int i;
+
+	for (i = 0; i < num; i++)
+		thread_yield(THREAD_ANY);
+	return (void *)(num * num);
+}
+
+static void *
+test_join_sleeper(void *arg)
+{
+	int enabled = interrupts_off();
+	Tid ret;
+
+	ret = thread_sleep(join_queue);
+	assert(thread_ret_ok(ret));
+	interrupts_set(enabled);
+	return arg;
+}
+
+/* join join_target, and return its status plus arg */
+static void *
+test_join_joiner(void *arg)
+{
+	void *status;
+	Tid ret;
+
+	ret = thread_join(join_target, &status);
+	assert(ret == join_target);
+	return (void *)((long)status + (long)arg);
+}
+
+static void
+test_join_nothing(void *arg)
+{
+	thread_yield(THREAD_ANY);
+}
+
+void
+test_join()
+{
+	Tid tids[NJOIN];
+	void *status;
+	long i;
+	Tid ret;
+
+	unintr_printf("starting join test\n");
+	assert(thread_join(thread_id(), NULL) == THREAD_INVALID);
+	assert(thread_join(THREAD_MAX_THREADS - 1, NULL) == THREAD_INVALID);
+
+	/* collect the exit status of each thread */
+	for (i = 0; i < NJOIN; i++) {
+		tids[i] = thread_spawn(test_join_square, (void *)i);
+		assert(thread_ret_ok(tids[i]));
+	}
+	for (i = NJOIN - 1; i >= 0; i--) {
+		ret = thread_join(tids[i], &status);
+		assert(ret == tids[i]);
+		assert((long)status == i * i);
+		/* the thread is gone */
+		assert(thread_join(tids[i], NULL) == THREAD_INVALID);
+	}
+
+	/* several threads join the same thread, and all are woken up when it
+	 * exits */
+	join_queue = wait_queue_create();
+	join_target = thread_spawn(test_join_sleeper, (void *)100L);
+	assert(thread_ret_ok(join_target));
+	for (i = 0; i < NJOIN; i++) {
+		tids[i] = thread_spawn(test_join_joiner, (void *)i);
+		assert(thread_ret_ok(tids[i]));
+	}
+	/* let the target sleep and the joiners wait */
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	ret = thread_wakeup(join_queue, 0);
+	assert(ret == 1);
+	for (i = 0; i < NJOIN; i++) {
+		ret = thread_join(tids[i], &status);
+		assert(ret == tids[i]);
+		assert((long)status == 100 + i);
+	}
+	wait_queue_destroy(join_queue);
+
+	/* threads from thread_create and destroyed threads exit with NULL */
+	ret = thread_create(test_join_nothing, NULL);
+	assert(thread_ret_ok(ret));
+	status = (void *)1;
+	assert(thread_join(ret, &status) == ret);
+	assert(status == NULL);
+
+	join_target = thread_create(test_join_nothing, NULL);
+	assert(thread_ret_ok(join_target));
+	tids[0] = thread_spawn(test_join_joiner, (void *)5L);
+	assert(thread_ret_ok(tids[0]));
+	/* the joiner waits, then the target is destroyed while READY */
+	ret = thread_yield(tids[0]);
+	assert(ret == tids[0]);
+	ret = thread_exit(join_target);
+	assert(ret == join_target);
+	ret = thread_join(tids[0], &status);
+	assert(ret == tids[0]);
+	assert((long)status == 5);
+	unintr_printf("join test done\n");
+}
+
+/* sleep test */
+
+#define NSLEEP 8
+#define SLEEP_USECS 4000
+
+static int sleep_order[NSLEEP];
+static int nr_sleep_done;
+
+static long
+elapsed_usecs(struct timeval *start)
+{
+	struct timeval end, diff;
+
+	gettimeofday(&end, NULL);
+	timersub(&end, start, &diff);
+	return diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+/* threads that sleep for longer wake up later */
+static void *
+test_sleep_thread(void *arg)
+{
+	long num = (long)arg;
+	int enabled, ret;
+
+	ret = thread_sleep_for((NSLEEP - num) * SLEEP_USECS);
+	assert(ret == 0);
+	enabled = interrupts_off();
+	sleep_order[nr_sleep_done++] = num;
+	interrupts_set(enabled);
+	return NULL;
+}
+
+static void *
+test_sleep_timed(void *arg)
+{
+	struct timeval *start = arg;
+	int ret;
+
+	ret = thread_sleep_for(SLEEP_USECS);
+	assert(ret == 0);
+	return (void *)elapsed_usecs(start);
+}
+
+static struct lock *sleep_lock;
+static struct cv *sleep_cv;
+
+/* wait on sleep_cv for long enough that it is signalled first */
+static void *
+test_sleep_cv(void *arg)
+{
+	int ret;
+
+	lock_acquire(sleep_lock);
+	ret = cv_timedwait(sleep_cv, sleep_lock, 20 * SLEEP_USECS);
+	lock_release(sleep_lock);
+	return (void *)(long)ret;
+}
+
+void
+test_sleep()
+{
+	struct timeval start;
+	struct rusage ru;
+	Tid tids[NSLEEP];
+	void *status;
+	long i, usecs, nvcsw;
+	Tid ret;
+
+	unintr_printf("starting sleep test\n");
+	assert(thread_sleep_for(-1) == THREAD_INVALID);
+
+	/* with no other thread to run */
+	gettimeofday(&start, NULL);
+	ret = thread_sleep_for(SLEEP_USECS);
+	assert(ret == 0);
+	usecs = elapsed_usecs(&start);
+	assert(usecs >= SLEEP_USECS && usecs < 100 * SLEEP_USECS);
+	ret = thread_sleep_for(0);
+	assert(ret == 0);
+
+	/* the idle loop only wakes up for the cascades of a long sleep, and
+	 * every 10 ms, rather than polling the wheel */
+	getrusage(RUSAGE_THREAD, &ru);
+	ret = thread_sleep_for(50 * SLEEP_USECS);
+	assert(ret == 0);
+	nvcsw = ru.ru_nvcsw;
+	getrusage(RUSAGE_THREAD, &ru);
+	assert(ru.ru_nvcsw - nvcsw < 50);
+
+	/* threads wake up in the order of their timeouts */
+	for (i = 0; i < NSLEEP; i++) {
+		tids[i] = thread_spawn(test_sleep_thread, (void *)i);
+		assert(thread_ret_ok(tids[i]));
+	}
+	for (i = 0; i < NSLEEP; i++) {
+		ret = thread_join(tids[i], NULL);
+		assert(ret == tids[i]);
+	}
+	for (i = 0; i < NSLEEP; i++)
+		assert(sleep_order[i] == NSLEEP - 1 - i);
+
+	/* the timer interrupt wakes a thread up while another one runs */
+	gettimeofday(&start, NULL);
+	tids[0] = thread_spawn(test_sleep_timed, &start);
+	assert(thread_ret_ok(tids[0]));
+	spin(20 * SLEEP_USECS);
+	ret = thread_join(tids[0], &status);
+	assert(ret == tids[0]);
+	usecs = (long)status;
+	assert(usecs >= SLEEP_USECS && usecs < 10 * SLEEP_USECS);
+
+	/* a cv wait that times out owns the lock again */
+	sleep_lock = lock_create();
+	sleep_cv = cv_create();
+	lock_acquire(sleep_lock);
+	gettimeofday(&start, NULL);
+	ret = cv_timedwait(sleep_cv, sleep_lock, SLEEP_USECS);
+	assert(ret == 0);
+	usecs = elapsed_usecs(&start);
+	assert(usecs >= SLEEP_USECS && usecs < 100 * SLEEP_USECS);
+	lock_release(sleep_lock);
+
+	/* a signalled one does not time out later */
+	tids[0] = thread_spawn(test_sleep_cv, NULL);
+	assert(thread_ret_ok(tids[0]));
+	thread_yield(tids[0]);
+	lock_acquire(sleep_lock);
+	cv_signal(sleep_cv, sleep_lock);
+	lock_release(sleep_lock);
+	ret = thread_join(tids[0], &status);
+	assert(ret == tids[0]);
+	assert((long)status == 1);
+	ret = thread_sleep_for(25 * SLEEP_USECS);
+	assert(ret == 0);
+	cv_destroy(sleep_cv);
+	lock_destroy(sleep_lock);
+	unintr_printf("sleep test done\n");
+}
+
+/* sync test */
+
+#define NSYNC 16
+
+static struct rwlock *sync_rw;
+static struct semaphore *sync_sem;
+static struct barrier *sync_barrier;
+static int sync_readers, sync_writers, sync_max;
+static int sync_order[2], nr_sync_order;
+static int sync_arrived[LOOPS], nr_sync_last;
+
+/* every fourth thread writes, and the others read */
+static void *
+test_sync_rw(void *arg)
+{
+	long num = (long)arg;
+	int i, n;
+
+	for (i = 0; i < LOOPS; i++) {
+		if (num % 4 == 0) {
+			rwlock_write_acquire(sync_rw);
+			assert(__sync_fetch_and_add(&sync_writers, 1) == 0);
+			assert(sync_readers == 0);
+			thread_yield(THREAD_ANY);
+			assert(sync_readers == 0);
+			__sync_fetch_and_sub(&sync_writers, 1);
+			rwlock_write_release(sync_rw);
+		} else {
+			rwlock_read_acquire(sync_rw);
+			assert(sync_writers == 0);
+			n = __sync_add_and_fetch(&sync_readers, 1);
+			if (n > sync_max)
+				sync_max = n;
+			thread_yield(THREAD_ANY);
+			assert(sync_writers == 0);
+			__sync_fetch_and_sub(&sync_readers, 1);
+			rwlock_read_release(sync_rw);
+		}
+		thread_yield(THREAD_ANY);
+	}
+	return NULL;
+}
+
+/* record the order in which a waiting writer and a later reader get in */
+static void *
+test_sync_writer(void *arg)
+{
+	rwlock_write_acquire(sync_rw);
+	sync_order[nr_sync_order++] = 1;
+	rwlock_write_release(sync_rw);
+	return NULL;
+}
+
+static void *
+test_sync_reader(void *arg)
+{
+	rwlock_read_acquire(sync_rw);
+	sync_order[nr_sync_order++] = 2;
+	rwlock_read_release(sync_rw);
+	return NULL;
+}
+
+static void *
+test_sync_down(void *arg)
+{
+	semaphore_down(sync_sem);
+	sync_order[nr_sync_order++] = 3;
+	return NULL;
+}
+
+/* at most two threads at a time get past the semaphore */
+static void *
+test_sync_sem(void *arg)
+{
+	int i, n;
+
+	for (i = 0; i < LOOPS; i++) {
+		semaphore_down(sync_sem);
+		n = __sync_add_and_fetch(&sync_readers, 1);
+		assert(n <= 2);
+		if (n > sync_max)
+			sync_max = n;
+		thread_yield(THREAD_ANY);
+		__sync_fetch_and_sub(&sync_readers, 1);
+		semaphore_up(sync_sem);
+	}
+	return NULL;
+}
+
+/* no thread starts a round before all of them have finished the last one */
+static void *
+test_sync_barrier(void *arg)
+{
+	int i;
+
+	for (i = 0; i < LOOPS; i++) {
+		__sync_fetch_and_add(&sync_arrived[i], 1);
+		if (barrier_wait(sync_barrier))
+			__sync_fetch_and_add(&nr_sync_last, 1);
+		assert(sync_arrived[i] == NSYNC);
+	}
+	return NULL;
+}
+
+/* run NSYNC threads of fn to completion */
+static void
+test_sync_run(void *(*fn)(void *))
+{
+	Tid tids[NSYNC];
+	long i;
+	Tid ret;
+
+	for (i = 0; i < NSYNC; i++) {
+		tids[i] = thread_spawn(fn, (void *)i);
+		assert(thread_ret_ok(tids[i]));
+	}
+	for (i = 0; i < NSYNC; i++) {
+		ret = thread_join(tids[i], NULL);
+		assert(ret == tids[i]);
+	}
+}
+
+void
+test_sync()
+{
+	Tid writer, reader, ret;
+
+	unintr_printf("starting sync test\n");
+
+	/* readers share the lock, and writers hold it alone */
+	sync_rw = rwlock_create();
+	test_sync_run(test_sync_rw);
+	assert(sync_max > 1);
+
+	/* a reader does not get in ahead of a waiting writer */
+	rwlock_read_acquire(sync_rw);
+	writer = thread_spawn(test_sync_writer, NULL);
+	assert(thread_ret_ok(writer));
+	thread_yield(writer);
+	reader = thread_spawn(test_sync_reader, NULL);
+	assert(thread_ret_ok(reader));
+	thread_yield(reader);
+	assert(nr_sync_order == 0);
+	rwlock_read_release(sync_rw);
+	ret = thread_join(writer, NULL);
+	assert(ret == writer);
+	ret = thread_join(reader, NULL);
+	assert(ret == reader);
+	assert(sync_order[0] == 1 && sync_order[1] == 2);
+
+	/* a writer that is destroyed while it waits does not get the lock */
+	nr_sync_order = 0;
+	rwlock_read_acquire(sync_rw);
+	writer = thread_spawn(test_sync_writer, NULL);
+	assert(thread_ret_ok(writer));
+	thread_yield(writer);
+	reader = thread_spawn(test_sync_reader, NULL);
+	assert(thread_ret_ok(reader));
+	thread_yield(reader);
+	ret = thread_exit(writer);
+	assert(ret == writer);
+	rwlock_read_release(sync_rw);
+	ret = thread_join(writer, NULL);
+	assert(ret == writer);
+	ret = thread_join(reader, NULL);
+	assert(ret == reader);
+	assert(nr_sync_order == 1 && sync_order[0] == 2);
+
+	/* and a reader that is destroyed while it waits does not hold it */
+	rwlock_write_acquire(sync_rw);
+	reader = thread_spawn(test_sync_reader, NULL);
+	assert(thread_ret_ok(reader));
+	thread_yield(reader);
+	ret = thread_exit(reader);
+	assert(ret == reader);
+	rwlock_write_release(sync_rw);
+	ret = thread_join(reader, NULL);
+	assert(ret == reader);
+	rwlock_write_acquire(sync_rw);
+	rwlock_write_release(sync_rw);
+	assert(nr_sync_order == 1);
+	rwlock_destroy(sync_rw);
+
+	sync_sem = semaphore_create(2);
+	sync_max = 0;
+	test_sync_run(test_sync_sem);
+	assert(sync_max == 2);
+	semaphore_destroy(sync_sem);
+
+	/* a waiter that is destroyed does not take the increment */
+	sync_sem = semaphore_create(0);
+	reader = thread_spawn(test_sync_down, NULL);
+	assert(thread_ret_ok(reader));
+	thread_yield(reader);
+	ret = thread_exit(reader);
+	assert(ret == reader);
+	semaphore_up(sync_sem);
+	ret = thread_join(reader, NULL);
+	assert(ret == reader);
+	semaphore_down(sync_sem);
+	assert(nr_sync_order == 1);
+	semaphore_destroy(sync_sem);
+
+	sync_barrier = barrier_create(NSYNC);
+	test_sync_run(test_sync_barrier);
+	assert(nr_sync_last == LOOPS);
+	barrier_destroy(sync_barrier);
+	unintr_printf("sync test done\n");
+}
+
+/* io test */
+
+#define IO_BYTES (1 << 20)
+
+static int io_fds[2];
+static volatile int io_done;
+
+/* read what the other end writes, until it closes it, and return the number
+ * of bytes read */
+static void *
+test_io_reader(void *arg)
+{
+	static char buf[IO_BYTES];
+	long total = 0;
+	ssize_t n;
+
+	while ((n = thread_read(io_fds[0], buf, sizeof(buf))) > 0) {
+		total += n;
+		io_done = 1;
+	}
+	assert(n == 0);
+	return (void *)total;
+}
+
+/* write all of buf to fd */
+static void
+test_io_write(int fd, const char *buf, long len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = thread_write(fd, buf, len);
+		assert(n > 0);
+		buf += n;
+		len -= n;
+	}
+}
+
+static void *
+test_io_writer(void *arg)
+{
+	int ret;
+
+	ret = thread_sleep_for(SLEEP_USECS);
+	assert(ret == 0);
+	test_io_write(io_fds[1], "hello", 5);
+	return NULL;
+}
+
+static void *
+test_io_server(void *arg)
+{
+	int listener = (long)arg;
+	char buf[8];
+	ssize_t n;
+	int sock;
+
+	sock = thread_accept(listener, NULL, NULL);
+	assert(sock >= 0);
+	n = thread_read(sock, buf, sizeof(buf));
+	assert(n == 4 && memcmp(buf, "ping", 4) == 0);
+	test_io_write(sock, "pong", 4);
+	close(sock);
+	return NULL;
+}
+
+void
+test_io()
+{
+	static char buf[IO_BYTES];
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	struct timeval start;
+	int listener, sock, ret;
+	void *status;
+	Tid tid;
+	ssize_t n;
+
+	unintr_printf("starting io test\n");
+	assert(thread_wait_fd(-1, 0) == THREAD_INVALID);
+	ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, io_fds);
+	assert(ret == 0);
+
+	/* the reader waits while this thread runs */
+	tid = thread_spawn(test_io_reader, NULL);
+	assert(thread_ret_ok(tid));
+	thread_yield(tid);
+	assert(!io_done);
+	test_io_write(io_fds[1], "hello", 5);
+
+	/* a timer interrupt polls for the reader while this thread spins */
+	gettimeofday(&start, NULL);
+	while (!io_done && elapsed_usecs(&start) < 1000000)
+		;
+	assert(io_done);
+
+	/* the writer waits for the reader to make room */
+	memset(buf, 'x', sizeof(buf));
+	test_io_write(io_fds[1], buf, sizeof(buf));
+	close(io_fds[1]);
+	ret = thread_join(tid, &status);
+	assert(ret == tid);
+	assert((long)status == 5 + IO_BYTES);
+	close(io_fds[0]);
+
+	/* an idle VP polls when no other thread runs */
+	ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, io_fds);
+	assert(ret == 0);
+	tid = thread_spawn(test_io_writer, NULL);
+	assert(thread_ret_ok(tid));
+	n = thread_read(io_fds[0], buf, sizeof(buf));
+	assert(n == 5 && memcmp(buf, "hello", 5) == 0);
+	ret = thread_join(tid, NULL);
+	assert(ret == tid);
+	close(io_fds[0]);
+	close(io_fds[1]);
+
+	/* a client and a server over TCP */
+	listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	assert(listener >= 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ret = bind(listener, (struct sockaddr *)&addr, sizeof(addr));
+	assert(ret == 0);
+	ret = listen(listener, 1);
+	assert(ret == 0);
+	ret = getsockname(listener, (struct sockaddr *)&addr, &len);
+	assert(ret == 0);
+	tid = thread_spawn(test_io_server, (void *)(long)listener);
+	assert(thread_ret_ok(tid));
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	assert(sock >= 0);
+	ret = thread_connect(sock, (struct sockaddr *)&addr, sizeof(addr));
+	assert(ret == 0);
+	test_io_write(sock, "ping", 4);
+	n = thread_read(sock, buf, sizeof(buf));
+	assert(n == 4 && memcmp(buf, "pong", 4) == 0);
+	n = thread_read(sock, buf, sizeof(buf));
+	assert(n == 0);
+	ret = thread_join(tid, NULL);
+	assert(ret == tid);
+	close(sock);
+	close(listener);
+	unintr_printf("io test done\n");
+}
+
+/* chan test */
+
+#define NMSGS 1000
+#define CHAN_CAPACITY 4
+
+static struct chan *chans[3];
+static volatile int chan_got;
+
+/* receive numbers from chans[0], and send them on plus one to chans[1] */
+static void *
+test_chan_stage(void *arg)
+{
+	long v;
+	int i;
+
+	for (i = 0; i < NMSGS; i++) {
+		chan_recv(chans[0], &v);
+		v++;
+		chan_send(chans[1], &v);
+	}
+	return NULL;
+}
+
+static void *
+test_chan_producer(void *arg)
+{
+	struct chan *ch = arg;
+	long v;
+
+	for (v = 0; v < NMSGS; v++)
+		chan_send(ch, &v);
+	return NULL;
+}
+
+static void *
+test_chan_receiver(void *arg)
+{
+	long v;
+
+	chan_recv(chans[2], &v);
+	chan_got = 1;
+	return (void *)v;
+}
+
+void
+test_chan()
+{
+	Tid tids[2], ret;
+	void *status;
+	long v, i;
+
+	unintr_printf("starting chan test\n");
+
+	/* messages come out in order, until the channel is full or empty */
+	chans[0] = chan_create(sizeof(long), CHAN_CAPACITY);
+	assert(chan_try_recv(chans[0], &v) == 0);
+	for (i = 0; i < CHAN_CAPACITY; i++)
+		assert(chan_try_send(chans[0], &i) == 1);
+	assert(chan_try_send(chans[0], &i) == 0);
+	for (i = 0; i < CHAN_CAPACITY; i++) {
+		assert(chan_try_recv(chans[0], &v) == 1);
+		assert(v == i);
+	}
+	assert(chan_try_recv(chans[0], &v) == 0);
+
+	/* a pipeline of two stages, where senders and receivers wait */
+	chans[1] = chan_create(sizeof(long), CHAN_CAPACITY);
+	tids[0] = thread_spawn(test_chan_producer, chans[0]);
+	assert(thread_ret_ok(tids[0]));
+	tids[1] = thread_spawn(test_chan_stage, NULL);
+	assert(thread_ret_ok(tids[1]));
+	for (i = 0; i < NMSGS; i++) {
+		chan_recv(chans[1], &v);
+		assert(v == i + 1);
+	}
+	for (i = 0; i < 2; i++) {
+		ret = thread_join(tids[i], NULL);
+		assert(ret == tids[i]);
+	}
+
+	/* without a buffer, each send waits for a receive */
+	chans[2] = chan_create(sizeof(long), 0);
+	assert(chan_try_send(chans[2], &i) == 0);
+	tids[0] = thread_spawn(test_chan_producer, chans[2]);
+	assert(thread_ret_ok(tids[0]));
+	for (i = 0; i < NMSGS; i++) {
+		chan_recv(chans[2], &v);
+		assert(v == i);
+	}
+	ret = thread_join(tids[0], NULL);
+	assert(ret == tids[0]);
+
+	/* a send to a waiting receiver switches to it */
+	tids[0] = thread_spawn(test_chan_receiver, NULL);
+	assert(thread_ret_ok(tids[0]));
+	thread_yield(tids[0]);
+	assert(!chan_got);
+	v = 42;
+	assert(chan_try_send(chans[2], &v) == 1);
+	assert(chan_got);
+	ret = thread_join(tids[0], &status);
+	assert(ret == tids[0]);
+	assert((long)status == 42);
+
+	/* a waiter that is destroyed gets no message, and sends none */
+	tids[0] = thread_spawn(test_chan_receiver, NULL);
+	assert(thread_ret_ok(tids[0]));
+	thread_yield(tids[0]);
+	ret = thread_exit(tids[0]);
+	assert(ret == tids[0]);
+	assert(chan_try_send(chans[2], &v) == 0);
+	ret = thread_join(tids[0], NULL);
+	assert(ret == tids[0]);
+	tids[0] = thread_spawn(test_chan_producer, chans[2]);
+	assert(thread_ret_ok(tids[0]));
+	thread_yield(tids[0]);
+	ret = thread_exit(tids[0]);
+	assert(ret == tids[0]);
+	assert(chan_try_recv(chans[2], &v) == 0);
+	ret = thread_join(tids[0], NULL);
+	assert(ret == tids[0]);
+
+	for (i = 0; i < 3; i++)
+		chan_destroy(chans[i]);
+	unintr_printf("chan test done\n");
+}
+
+/* stats test */
+
+#define STATS_USECS 20000
+
+static struct thread_stats stats_of[3];
+
+/* two threads spin at once, and a third one sleeps */
+static void *
+test_stats_thread(void *arg)
+{
+	long num = (long)arg;
+	Tid ret;
+
+	if (num < 2)
+		spin(STATS_USECS);
+	else
+		assert(thread_sleep_for(STATS_USECS) == 0);
+	ret = thread_stats(THREAD_SELF, &stats_of[num]);
+	assert(ret == thread_id());
+	return NULL;
+}
+
+void
+test_stats()
+{
+	struct thread_stats stats;
+	Tid tids[3], ret;
+	long i;
+
+	unintr_printf("starting stats test\n");
+	assert(thread_stats(THREAD_MAX_THREADS, &stats) == THREAD_INVALID);
+	ret = thread_stats(THREAD_SELF, &stats);
+	assert(ret == thread_id());
+	assert(stats.preempts == 0);
+
+	for (i = 0; i < 3; i++) {
+		tids[i] = thread_spawn(test_stats_thread, (void *)i);
+		assert(thread_ret_ok(tids[i]));
+	}
+	ret = thread_stats(tids[0], &stats);
+	assert(ret == tids[0]);
+	assert(stats.run_ns == 0 && stats.switches == 0);
+	for (i = 0; i < 3; i++) {
+		ret = thread_join(tids[i], NULL);
+		assert(ret == tids[i]);
+	}
+
+	/* the spinners took turns for the whole time, so each of them ran
+	 * for part of it, and waited while the other one ran */
+	for (i = 0; i < 2; i++) {
+		assert(stats_of[i].run_ns + stats_of[i].ready_ns >=
+		       STATS_USECS * 1000 * 9 / 10);
+		assert(stats_of[i].run_ns >= STATS_USECS * 1000 / 4);
+		assert(stats_of[i].ready_ns >= STATS_USECS * 1000 / 4);
+		assert(stats_of[i].preempts > 0);
+	}
+	/* the sleeper hardly ran */
+	assert(stats_of[2].sleep_ns >= STATS_USECS * 1000 * 9 / 10);
+	assert(stats_of[2].run_ns < STATS_USECS * 1000);
+	assert(stats_of[2].switches > 0);
+	print_rdyq();
+	unintr_printf("stats test done\n");
+}
+
+static struct lock *trace_lock;
+
+static void *
+test_trace_thread(void *arg)
+{
+	lock_acquire(trace_lock);
+	thread_yield(THREAD_ANY);
+	lock_release(trace_lock);
+	assert(thread_sleep_for(1000) == 0);
+	return NULL;
+}
+
+/* export the trace to a temporary file, and return its contents */
+static char *
+test_trace_export(long *nr)
+{
+	char path[] = "/tmp/test_trace.XXXXXX";
+	char *buf;
+	FILE *f;
+	long len;
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	*nr = trace_export(path);
+	f = fopen(path, "r");
+	assert(f != NULL);
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	rewind(f);
+	buf = malloc(len + 1);
+	assert(buf != NULL);
+	assert(fread(buf, 1, len, f) == len);
+	buf[len] = 0;
+	fclose(f);
+	unlink(path);
+	return buf;
+}
+
+void
+test_trace()
+{
+	Tid tids[2], ret;
+	char *buf;
+	long nr, i;
+	int enabled;
+
+	unintr_printf("starting trace test\n");
+	trace_lock = lock_create();
+	trace_start();
+	for (i = 0; i < 2; i++) {
+		tids[i] = thread_spawn(test_trace_thread, NULL);
+		assert(thread_ret_ok(tids[i]));
+	}
+	for (i = 0; i < 2; i++) {
+		ret = thread_join(tids[i], NULL);
+		assert(ret == tids[i]);
+	}
+	trace_stop();
+	/* nothing is recorded while tracing is off */
+	thread_yield(THREAD_ANY);
+	buf = test_trace_export(&nr);
+	assert(nr > 0 && nr < TRACE_EVENTS);
+	assert(strncmp(buf, "{\"traceEvents\":[", 16) == 0);
+	assert(strcmp(buf + strlen(buf) - 4, "\n]}\n") == 0);
+	assert(strstr(buf, "\"name\":\"create\""));
+	assert(strstr(buf, "\"name\":\"run\",\"ph\":\"X\""));
+	assert(strstr(buf, "\"name\":\"yield\""));
+	assert(strstr(buf, "\"name\":\"lock_contend\""));
+	assert(strstr(buf, "\"name\":\"lock_release\""));
+	assert(strstr(buf, "\"name\":\"sleep\""));
+	assert(strstr(buf, "\"name\":\"wakeup\""));
+	assert(strstr(buf, "\"name\":\"exit\""));
+	free(buf);
+	lock_destroy(trace_lock);
+
+	/* the ring buffer keeps only the last TRACE_EVENTS events */
+	enabled = interrupts_set(0);
+	trace_start();
+	for (i = 0; i < TRACE_EVENTS + 100; i++)
+		TRACE(TRACE_YIELD, 0, thread_id(), i);
+	trace_stop();
+	interrupts_set(enabled);
+	buf = test_trace_export(&nr);
+	assert(nr == TRACE_EVENTS);
+	assert(strstr(buf, "\"args\":{\"arg\":99}") == NULL);
+	assert(strstr(buf, "\"args\":{\"arg\":100}"));
+	free(buf);
+	unintr_printf("trace test done\n");
+}
@@ -7,5 +7,15 @@ void test_wakeup(int all);
 void test_lock();
 void test_cv_signal();
 void test_cv_broadcast();
+void test_vps();
+void test_priority();
+void test_timer();
+void test_join();
+void test_sleep();
+void test_sync();
+void test_io();
+void test_chan();
+void test_stats();
+void test_trace();
 
 #endif /* _TEST_THREAD_H_ */
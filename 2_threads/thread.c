@@ -1,537 +1,1409 @@
 #include <assert.h>
+#include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
-#include <ucontext.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <x86intrin.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "thread.h"
 #include "interrupt.h"
+#include "stack.h"
+#include "timer_wheel.h"
+#include "trace.h"
 
 #define READY 0
 #define RUNNING 1
 #define EXIT 2
 #define SLEEP 3
 
+/* the default floating point control words of the x86-64 ABI */
+#define INITIAL_MXCSR 0x1f80
+#define INITIAL_FPCW 0x037f
+
+/* how long an idle VP waits before looking for threads again, in ns */
+#define IDLE_TIMEOUT 10000000
+/* the most file descriptor events handled by one poll */
+#define IO_EVENTS 64
+
+/* keep per-thread statistics, see thread_stats. build with -DTHREAD_STATS=0
+ * to leave them out. */
+#ifndef THREAD_STATS
+#define THREAD_STATS 1
+#endif
+
+/* the scheduler is a multi-level feedback queue. a thread that has run for
+ * PRIO_ALLOT timer ticks at a priority level, whether or not it gave up the
+ * processor in between, moves down a level. every BOOST_TICKS ticks, all
+ * threads move back up to their base priority, so that none starve. */
+#define PRIO_ALLOT 2
+#define BOOST_TICKS 250
+
 /* This is the thread control block */
-typedef struct thread{
+typedef struct thread {
 	Tid id;
-	int state; // 0 ready, 1 running, 2 exit, 3 sleep
-	ucontext_t *tcontext;
+	int state;	/* READY, RUNNING, EXIT or SLEEP */
+	int killed;	/* destroyed by another thread while not READY */
+	void *sp;	/* saved stack pointer, see switch.S */
+	void *stack;
+	int prio;	/* priority level, 0 is the highest */
+	int base_prio;	/* the highest level prio can be boosted to */
+	int ticks;	/* timer ticks at this level */
+	struct vp *vp;	/* the VP whose ready queue the thread is on */
+	/* links in the ready queue, or the wait queue of a sleeping thread */
+	struct thread *prev;
 	struct thread *next;
-	/* ... Fill this in ... */
-}thread;
+	/* statistics, in TSC cycles */
+	unsigned long stamp;	/* when the thread last changed state */
+	unsigned long run;	/* time RUNNING */
+	unsigned long wait;	/* time READY */
+	unsigned long sleep;	/* time in SLEEP */
+	unsigned long switches;	/* times it was switched out */
+	unsigned long preempts;	/* of those, by the timer interrupt */
+	/* the fields above are used on every switch, these ones less often */
+	void *status;	/* exit status, passed to the threads that join it */
+	void *joined;	/* the exit status of the thread this one joined */
+	struct wait_queue *joiners;	/* threads in thread_join, or NULL */
+	int joinable;	/* keep the TCB after exiting, until joined */
+	struct wait_queue *waiting;	/* the queue it sleeps in, or NULL */
+	struct wheel_timer timer;	/* ends a timed sleep */
+	int timed_out;	/* the last timed sleep ended with the timer */
+} thread;
+
+/* a FIFO queue of threads, linked through the threads themselves, so that
+ * adding, removing and taking the first thread are all O(1) */
+struct thread_queue {
+	thread *head;
+	thread *tail;
+};
+
+/* A virtual processor, i.e., a kernel thread that runs threads. There is only
+ * one, the initial kernel thread of the process, unless thread_set_vps()
+ * starts more. Each VP has its own ready queues, one per priority level. A
+ * VP runs the first thread of its highest priority queue, or steals from the
+ * tail of a higher priority queue of another VP, and otherwise runs its idle
+ * loop. All of this state is protected by disabling interrupts, which
+ * takes a global lock when there is more than one VP (see interrupt.c). */
+struct vp {
+	int id;
+	thread *running;	/* the RUNNING thread */
+	thread idle;	/* runs vp_idle() */
+	/* the READY threads of each level, in the order they will run */
+	struct thread_queue ready[THREAD_PRIO_LEVELS];
+	unsigned int ready_map;	/* bit i is set when ready[i] is not empty */
+};
+
+/* every thread that has not exited, indexed by its Tid */
+static thread *threads[THREAD_MAX_THREADS];
+static int nr_threads;
+static unsigned long nr_ticks;
+/* bit i of the map is set when Tid i is in use */
+#define TID_BITS (8 * sizeof(unsigned long))
+#define TID_WORDS ((THREAD_MAX_THREADS + TID_BITS - 1) / TID_BITS)
+static unsigned long tid_map[TID_WORDS];
+static struct vp vps[THREAD_MAX_VPS];
+static int nr_vps = 1;
+static __thread struct vp *vp_tls;
+/* idle VPs wait in the epoll set until kick_fd is written, see vp_kick */
+static int nr_idle;
+static int nr_kicks;
+/* threads that exited themselves, and whose stack may still have been in use
+ * when they were queued. they are freed by the next thread to run. */
+static struct thread_queue zombies;
+/* the timers of the threads in a timed sleep, in microseconds. it is checked
+ * on each timer interrupt, and by idle VPs. */
+static struct timer_wheel wheel;
+/* the TSC and the monotonic clock at thread_init, to convert TSC cycles to
+ * nanoseconds */
+static unsigned long init_tsc;
+static unsigned long init_ns;
+/* the epoll instance for the file descriptors that threads wait for, and the
+ * waiters of each descriptor, see thread_wait_fd. it is polled on each timer
+ * interrupt, and by idle VPs, which also wait in it for kick_fd. */
+static int epfd = -1;
+static int kick_fd = -1;
+static struct fd_waiters **fd_table;
+static int fd_table_size;
+static int nr_io_waiters;
+
+/* in switch.S */
+void switch_context(void **save_sp, void *sp);
+void switch_start(void);
+
+static struct vp *vp_self(void) __attribute__((noipa));
+static void thread_stub(void (*thread_main) (void *), void *arg);
+static void thread_spawn_stub(void *(*thread_main) (void *), void *arg);
+static void thread_finish(void);
+static void join_wakeup(thread *t);
+static void wait_wake(thread *t);
+static void io_poll(long nsecs);
+
+/* the RUNNING thread of the calling VP */
+#define curr (vp_self()->running)
+
+/* returns the VP of the calling kernel thread. A thread can continue on
+ * another kernel thread after any switch, so the compiler must not reuse an
+ * earlier result, which noipa prevents. */
+static struct vp *
+vp_self(void)
+{
+	return vp_tls;
+}
+
+static void
+queue_push(struct thread_queue *q, thread *t)
+{
+	t->next = NULL;
+	t->prev = q->tail;
+	if (q->tail)
+		q->tail->next = t;
+	else
+		q->head = t;
+	q->tail = t;
+}
+
+static void
+queue_remove(struct thread_queue *q, thread *t)
+{
+	if (t->prev)
+		t->prev->next = t->next;
+	else
+		q->head = t->next;
+	if (t->next)
+		t->next->prev = t->prev;
+	else
+		q->tail = t->prev;
+	t->prev = NULL;
+	t->next = NULL;
+}
+
+/* wake up an idle VP. kick_fd is a semaphore, so each kick is taken by one
+ * idle VP, and nr_kicks counts the ones not taken yet, so that there are never
+ * more of them than idle VPs. */
+static void
+vp_kick(void)
+{
+	uint64_t one = 1;
+
+	if (write(kick_fd, &one, sizeof(one)) == sizeof(one))
+		nr_kicks++;
+}
+
+/* the TSC, or 0 without statistics */
+static inline unsigned long
+stats_now(void)
+{
+#if THREAD_STATS
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* account for the time t slept, if it is being woken up */
+static inline void
+stats_wake(thread *t)
+{
+#if THREAD_STATS
+	unsigned long now;
+
+	if (t->state != SLEEP)
+		return;
+	now = __rdtsc();
+	t->sleep += now - t->stamp;
+	t->stamp = now;
+#endif
+}
+
+/* account for the time prev ran, and the time next was READY */
+static inline void
+stats_switch(thread *prev, thread *next)
+{
+#if THREAD_STATS
+	unsigned long now = __rdtsc();
+
+	prev->run += now - prev->stamp;
+	prev->stamp = now;
+	prev->switches++;
+	if (next->state == READY)
+		next->wait += now - next->stamp;
+	next->stamp = now;
+#endif
+}
+
+/* start the statistics of t, a new thread */
+static void
+stats_init(thread *t)
+{
+	t->stamp = stats_now();
+	t->run = 0;
+	t->wait = 0;
+	t->sleep = 0;
+	t->switches = 0;
+	t->preempts = 0;
+}
+
+/* make t READY on the ready queue of its level on the calling VP */
+static void
+ready_push(thread *t)
+{
+	struct vp *vp = vp_self();
+
+	if (t->state == SLEEP)
+		TRACE(TRACE_WAKEUP, vp->id, t->id, vp->running->id);
+	stats_wake(t);
+	t->state = READY;
+	t->vp = vp;
+	queue_push(&vp->ready[t->prio], t);
+	vp->ready_map |= 1U << t->prio;
+	/* the running thread can now be preempted */
+	interrupts_start();
+	if (nr_idle > nr_kicks)
+		vp_kick();
+}
+
+static void
+ready_remove(thread *t)
+{
+	struct vp *vp = t->vp;
+
+	queue_remove(&vp->ready[t->prio], t);
+	if (vp->ready[t->prio].head == NULL)
+		vp->ready_map &= ~(1U << t->prio);
+}
+
+/* returns the VP with the highest priority READY thread, preferring the
+ * calling VP, or NULL when no thread is READY */
+static struct vp *
+ready_best(void)
+{
+	struct vp *vp = vp_self();
+	struct vp *best = vp->ready_map ? vp : NULL;
+	struct vp *other;
+	int i;
+
+	for (i = 1; i < nr_vps; i++) {
+		other = &vps[(vp->id + i) % nr_vps];
+		if (other->ready_map && (best == NULL ||
+		    __builtin_ctz(other->ready_map) <
+		    __builtin_ctz(best->ready_map)))
+			best = other;
+	}
+	return best;
+}
+
+/* takes the thread that should run next off the ready queues: the first
+ * thread of the highest priority queue of the calling VP, or the last thread
+ * of a queue of another VP that has a higher priority. Returns NULL when no
+ * thread is READY. */
+static thread *
+ready_take(void)
+{
+	struct vp *vp = ready_best();
+	int level;
+	thread *t;
+
+	if (vp == NULL)
+		return NULL;
+	level = __builtin_ctz(vp->ready_map);
+	if (vp == vp_self())
+		t = vp->ready[level].head;
+	else
+		t = vp->ready[level].tail;
+	ready_remove(t);
+	return t;
+}
+
+/* whether the idle loop can wait for a sleeping thread to be woken up: by a
+ * thread on another VP, or because the idle loop also runs the timers of
+ * sleeping threads, and polls the file descriptors that threads wait for */
+static int
+idle_can_wait(void)
+{
+	return (nr_vps > 1 && nr_threads > 1) || wheel.nr_timers ||
+	    nr_io_waiters;
+}
+
+/* returns the thread to switch to when the running thread stops running,
+ * taking it off the ready queues. This is the next READY thread, or the idle
+ * loop when the running thread may be woken up later. Returns NULL when there
+ * is no such thread. */
+static thread *
+sched_next(void)
+{
+	thread *t = ready_take();
+
+	if (t == NULL && idle_can_wait())
+		t = &vp_self()->idle;
+	return t;
+}
+
+/* the current time in microseconds, the unit of the timer wheel */
+static unsigned long
+now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/* make the threads whose timed sleep has expired READY */
+static void
+timers_run(void)
+{
+	struct wheel_timer *w;
+	thread *t;
+
+	if (wheel.nr_timers == 0)
+		return;
+	w = wheel_advance(&wheel, now_usecs());
+	while (w != NULL) {
+		t = (thread *)((char *)w - offsetof(thread, timer));
+		w = w->next;
+		t->timed_out = 1;
+		if (t->waiting)
+			wait_wake(t);
+		else
+			ready_push(t);
+	}
+}
+
+/* returns a thread running on another VP that has not been destroyed yet, or
+ * NULL if there is none */
+static thread *
+vp_running_other(void)
+{
+	thread *t;
+	int i;
+
+	for (i = 0; i < nr_vps; i++) {
+		t = vps[i].running;
+		if (t != curr && t->id != THREAD_NONE && !t->killed)
+			return t;
+	}
+	return NULL;
+}
+
+/* returns the thread with identifier tid, or NULL if there is none or it
+ * has exited */
+static thread *
+thread_lookup(Tid tid)
+{
+	if (tid < 0 || tid >= THREAD_MAX_THREADS || threads[tid] == NULL ||
+	    threads[tid]->state == EXIT)
+		return NULL;
+	return threads[tid];
+}
+
+/* returns the lowest unused thread identifier, or THREAD_NOMORE. checks a
+ * word of the map at a time. */
+static Tid
+id_alloc(void)
+{
+	unsigned int i;
+	Tid tid;
+
+	for (i = 0; i < TID_WORDS; i++) {
+		if (~tid_map[i] == 0)
+			continue;
+		tid = i * TID_BITS + __builtin_ctzl(~tid_map[i]);
+		if (tid >= THREAD_MAX_THREADS)
+			break;
+		tid_map[i] |= 1UL << (tid % TID_BITS);
+		return tid;
+	}
+	return THREAD_NOMORE;
+}
+
+/* makes tid available for reuse */
+static void
+id_free(Tid tid)
+{
+	assert(tid_map[tid / TID_BITS] & (1UL << (tid % TID_BITS)));
+	tid_map[tid / TID_BITS] &= ~(1UL << (tid % TID_BITS));
+	threads[tid] = NULL;
+}
+
+/* free a thread that is not running */
+static void
+thread_free(thread *t)
+{
+	if (t->stack)
+		stack_free(t->stack);
+	if (t->joiners)
+		wait_queue_destroy(t->joiners);
+	free(t);
+}
+
+/* free the threads that exited before the running thread was switched to.
+ * Only the stack of a joinable thread is freed, thread_join frees the rest. */
+static void
+thread_reap(void)
+{
+	thread *t;
+
+	while ((t = zombies.head) != NULL) {
+		queue_remove(&zombies, t);
+		if (t->joinable) {
+			stack_free(t->stack);
+			t->stack = NULL;
+		} else {
+			thread_free(t);
+		}
+	}
+}
+
+/* set up t, which has a stack, to start running fn(arg1, arg2) when it is
+ * switched to. the frame is the one switch_context saves, and returns to
+ * switch_start. */
+static void
+thread_frame(thread *t, void (*fn) (void), void *arg1, void *arg2)
+{
+	unsigned long *frame;
+
+	frame = (unsigned long *)((char *)t->stack + STACK_SIZE) - 8;
+	frame[0] = (unsigned long)INITIAL_FPCW << 32 | INITIAL_MXCSR;
+	frame[1] = 0;			/* r15 */
+	frame[2] = 0;			/* r14 */
+	frame[3] = (unsigned long)arg2;	/* r13 */
+	frame[4] = (unsigned long)arg1;	/* r12 */
+	frame[5] = (unsigned long)fn;	/* rbx */
+	frame[6] = 0;			/* rbp */
+	frame[7] = (unsigned long)switch_start;
+	t->sp = frame;
+}
+
+/* run next, a thread that has already been taken off the ready queue. The
+ * caller must have interrupts disabled, and must have put the running thread
+ * wherever it should wait. Returns when the running thread is switched back
+ * to, possibly on another VP. */
+static void
+thread_switch(thread *next)
+{
+	struct vp *vp = vp_self();
+	thread *prev = vp->running;
+
+	stats_switch(prev, next);
+	TRACE(TRACE_RUN, vp->id, next->id, prev->id);
+	vp->running = next;
+	next->state = RUNNING;
+	switch_context(&prev->sp, next->sp);
+	thread_reap();
+	if (curr->killed)
+		thread_finish();
+}
+
+/* The idle loop of a VP, entered with interrupts disabled. Runs READY threads
+ * as long as there are any, and otherwise waits in the epoll set until a
+ * thread is made READY, a file descriptor is ready, or the next timer. */
+static void
+vp_idle(void)
+{
+	unsigned long wait, expires, now;
+	thread *next;
+
+	for (;;) {
+		thread_reap();
+		timers_run();
+		next = ready_take();
+		if (next) {
+			interrupts_start();
+			thread_switch(next);
+			continue;
+		}
+		/* wake up in time for the next timer */
+		wait = IDLE_TIMEOUT;
+		expires = wheel_next(&wheel);
+		if (expires != ~0UL) {
+			now = now_usecs();
+			if (expires <= now)
+				continue;
+			if ((expires - now) * 1000 < wait)
+				wait = (expires - now) * 1000;
+		}
+		nr_idle++;
+		io_poll(wait);
+		nr_idle--;
+	}
+}
+
+static void
+vp_init(struct vp *vp, int id)
+{
+	vp->id = id;
+	vp->idle.id = THREAD_NONE;
+	vp->idle.state = RUNNING;
+	vp->idle.killed = 0;
+	vp->idle.vp = vp;
+	vp->running = &vp->idle;
+}
 
-thread *first;  //declare global variable
-thread *curr;
-int aid[1023]={0}; // available ID finder function
+/* create the epoll set that idle VPs wait in, with kick_fd in it. returns -1
+ * if that fails. */
+static int
+io_init(void)
+{
+	struct epoll_event ev;
 
+	if (epfd >= 0)
+		return 0;
+	kick_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	if (kick_fd < 0)
+		return -1;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.fd = kick_fd;
+	if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, kick_fd, &ev) < 0) {
+		if (epfd >= 0)
+			close(epfd);
+		close(kick_fd);
+		epfd = -1;
+		kick_fd = -1;
+		return -1;
+	}
+	return 0;
+}
 
-void print_rdyq(void);
-void thread_stub(void (*thread_main) (void *), void *arg);
-int tcounter(void);
+/* the initial VP runs its idle loop on a stack of its own, which is allocated
+ * when it is first needed, and every idle VP waits in the epoll set. returns
+ * THREAD_NOMEMORY if either cannot be set up. */
+static int
+vp0_idle_init(void)
+{
+	if (io_init() < 0)
+		return THREAD_NOMEMORY;
+	if (vps[0].idle.stack)
+		return 0;
+	vps[0].idle.stack = stack_alloc();
+	if (vps[0].idle.stack == NULL)
+		return THREAD_NOMEMORY;
+	thread_frame(&vps[0].idle, vp_idle, NULL, NULL);
+	return 0;
+}
 
-int id_calc(void); 
-//returns availalbe id spot.
+/* the kernel thread of each VP, other than the initial one */
+static void *
+vp_start(void *arg)
+{
+	vp_tls = arg;
+	interrupts_set(0);
+	vp_idle();
+	return NULL;
+}
 
 void
 thread_init(void)
 {
-	//extern thread *first;
-	first = (thread *)malloc(sizeof(thread));
-	first->id=id_calc();
-	first->state=RUNNING;  
-	first->next=NULL;
-	first->tcontext=(ucontext_t*)malloc(sizeof(ucontext_t));
-	//getcontext(first->tcontext);
-	curr=first;
-	/* your optional code here */
-	//register_interrupt_handler(1);
+	thread *t;
+
+	vp_init(&vps[0], 0);
+	vp_tls = &vps[0];
+	t = malloc(sizeof(thread));
+	assert(t);
+	t->id = 0;
+	t->state = RUNNING;
+	t->killed = 0;
+	t->prio = 0;
+	t->base_prio = 0;
+	t->ticks = 0;
+	t->status = NULL;
+	t->joiners = NULL;
+	t->joinable = 0;
+	t->waiting = NULL;
+	wheel_timer_init(&t->timer);
+	init_tsc = stats_now();
+	init_ns = now_usecs() * 1000;
+	stats_init(t);
+	wheel_init(&wheel, now_usecs());
+	/* the initial thread runs on the process stack */
+	t->stack = NULL;
+	t->prev = NULL;
+	t->next = NULL;
+	threads[0] = t;
+	tid_map[0] = 1;
+	nr_threads = 1;
+	vps[0].running = t;
+}
+
+int
+thread_set_vps(int n)
+{
+	pthread_t pt;
+	int i, ret;
+
+	if (nr_vps != 1 || n < 1 || n > THREAD_MAX_VPS)
+		return THREAD_INVALID;
+	if (n == 1)
+		return 1;
+	assert(interrupts_enabled());
+
+	if (vp0_idle_init() < 0)
+		return THREAD_NOMEMORY;
+
+	interrupts_smp();
+	interrupts_set(0);
+	for (i = 1; i < n; i++) {
+		vp_init(&vps[i], i);
+		ret = pthread_create(&pt, NULL, vp_start, &vps[i]);
+		if (ret)
+			break;
+		pthread_detach(pt);
+	}
+	nr_vps = i;
+	interrupts_set(1);
+	return nr_vps == n ? n : THREAD_FAILED;
 }
 
 Tid
 thread_id()
 {
-	return curr->id; 
+	/* keep the thread from moving to another VP while reading curr */
+	int enabled = interrupts_set(0);
+	Tid ret = curr->id;
+
+	interrupts_set(enabled);
+	return ret;
 }
 
-Tid
-thread_create(void (*fn) (void *), void *parg)
+/* create a thread that starts running stub(fn, arg) */
+static Tid
+thread_new(void (*stub) (void), void *fn, void *arg)
 {
 	int enabled = interrupts_set(0);
-	thread *current;
-	current=first;
-	
-	/*int tc=tcounter();
-	
-	if (tc+1>=THREAD_MAX_THREADS)
-		return THREAD_NOMORE;
-	*/
+	thread *t;
+	Tid tid;
 
-	while (current->next != NULL)
-	{
-		current=current->next;
-	}
-	current->next=malloc(sizeof(thread));
-	if (current->next == NULL)
-	{
+	tid = id_alloc();
+	if (tid < 0) {
 		interrupts_set(enabled);
-		return THREAD_NOMEMORY;
+		return THREAD_NOMORE;
 	}
-	
-	current=current->next;
-
-	current->id=id_calc();
-	current->state=READY;
-	current->next=NULL;
-	current->tcontext=(ucontext_t*)malloc(sizeof(ucontext_t));
-
-	if (current->tcontext == NULL)
-	{
+	t = malloc(sizeof(thread));
+	if (t == NULL) {
+		id_free(tid);
 		interrupts_set(enabled);
 		return THREAD_NOMEMORY;
 	}
-	
-
-	void *sp=(void*)malloc(THREAD_MIN_STACK);
-	if (sp == NULL)
-	{
+	t->stack = stack_alloc();
+	if (t->stack == NULL) {
+		free(t);
+		id_free(tid);
 		interrupts_set(enabled);
 		return THREAD_NOMEMORY;
 	}
 
-	
-    getcontext(current->tcontext);
-
-
-	current->tcontext->uc_mcontext.gregs[REG_RSP]=(unsigned long)(sp+THREAD_MIN_STACK-8);
-	current->tcontext->uc_mcontext.gregs[REG_RIP]=(unsigned long)thread_stub;
-	current->tcontext->uc_mcontext.gregs[REG_RDI]=(unsigned long)fn;
-	current->tcontext->uc_mcontext.gregs[REG_RSI]=(unsigned long)parg;
-    //printf("current id is %d\n",current->id);
-
+	/* start in the stub, with interrupts disabled until the stub enables
+	 * them */
+	thread_frame(t, stub, fn, arg);
+	t->id = tid;
+	t->killed = 0;
+	t->prio = 0;
+	t->base_prio = 0;
+	t->ticks = 0;
+	t->status = NULL;
+	t->joiners = NULL;
+	t->joinable = stub == (void (*)(void))thread_spawn_stub;
+	t->waiting = NULL;
+	wheel_timer_init(&t->timer);
+	t->state = READY;
+	stats_init(t);
+	threads[tid] = t;
+	nr_threads++;
+	ready_push(t);
+	TRACE(TRACE_CREATE, vp_self()->id, curr->id, tid);
 	interrupts_set(enabled);
-	return current->id;	
+	return tid;
+}
 
+Tid
+thread_create(void (*fn) (void *), void *parg)
+{
+	return thread_new((void (*)(void))thread_stub, fn, parg);
+}
+
+Tid
+thread_spawn(void *(*fn) (void *), void *arg)
+{
+	return thread_new((void (*)(void))thread_spawn_stub, fn, arg);
 }
 
 Tid
 thread_yield(Tid want_tid)
 {
-	
 	int enabled = interrupts_set(0);
-	int context_called=0;
-	thread *current;
-	current=curr;
-	//int abc=1;
-	//if (current->next==NULL)
-	//	current=first;
+	thread *next;
 
-	//printf("Yielding from %d to %d\n", curr->id, want_tid);
-
-	if ((want_tid > (THREAD_MAX_THREADS-1))||(want_tid<-7))
-	{
-		interrupts_set(enabled);
-		return THREAD_INVALID;
-	}
-	if (want_tid > tcounter())
-	{
+	/* the idle loop looks for threads to run by itself */
+	if (curr->id == THREAD_NONE) {
 		interrupts_set(enabled);
-		return THREAD_INVALID;
+		return THREAD_NONE;
 	}
-
-	if (want_tid==THREAD_SELF) //no-op. return current id and continue the execution.
-	{
+	/* destroyed by a thread on another VP while running */
+	if (curr->killed)
+		thread_finish();
+	/* without preemption, this is where timed sleeps end */
+	if (wheel.nr_timers)
+		timers_run();
+	if (want_tid == THREAD_SELF || want_tid == curr->id) {
 		interrupts_set(enabled);
 		return curr->id;
 	}
-
-	if (want_tid==THREAD_ANY)  //run any thread in the ready queue
-	{
-		//print_rdyq();
-		if (first->next==NULL) //if there is only 1 thread running
-		{
+	if (want_tid == THREAD_ANY) {
+		next = ready_take();
+		if (next == NULL) {
 			interrupts_set(enabled);
 			return THREAD_NONE;
 		}
-
-	
-		while(current->state != READY) //find the first thread that is in ready state
-		{
-			current=current->next;
-			if (current==NULL)
-			{
-				current=first;
-				while(current->state != READY)
-				{
-					if(current==curr)
-					{
-						interrupts_set(enabled);
-						return THREAD_NONE;	
-					}
-					current=current->next;
-					if(current==curr)
-					{
-						interrupts_set(enabled);
-						return THREAD_NONE;	
-					}
-				}
-				
-			}
+	} else {
+		next = thread_lookup(want_tid);
+		if (next == NULL || next->state != READY) {
+			interrupts_set(enabled);
+			return THREAD_INVALID;
 		}
-		//printf("Yielding from %d to %d \n", curr->id, current->id);
+		ready_remove(next);
+	}
 
-		curr->state=READY;
+	want_tid = next->id;
+	TRACE(TRACE_YIELD, vp_self()->id, curr->id, want_tid);
+	ready_push(curr);
+	thread_switch(next);
+	interrupts_set(enabled);
+	return want_tid;
+}
 
-		getcontext(curr->tcontext);
+Tid
+thread_exit(Tid tid)
+{
+	int enabled = interrupts_set(0);
+	thread *t;
 
-		if (context_called==1)
-		{
+	if (tid == THREAD_SELF || tid == curr->id) {
+		/* the joiners may be the only threads left to run */
+		join_wakeup(curr);
+		t = sched_next();
+		if (t == NULL) {
 			interrupts_set(enabled);
-			return curr->id;
+			return THREAD_NONE;
 		}
-
-		context_called=1;
-		curr=current;
-		curr->state=RUNNING;
-
-		setcontext(curr->tcontext);
-		return curr->id;
+		curr->state = EXIT;
+		if (!curr->joinable)
+			id_free(curr->id);
+		nr_threads--;
+		/* we are still running on our stack, so the next thread frees
+		 * it */
+		queue_push(&zombies, curr);
+		TRACE(TRACE_EXIT, vp_self()->id, curr->id, curr->id);
+		thread_switch(t);
+		assert(0);
 	}
 
-	current=first;
-	while (current->id != want_tid)
-	{
-		current=current->next;
-		if (current==NULL)
-		{
+	if (tid == THREAD_ANY) {
+		t = ready_take();
+		if (t == NULL)
+			t = vp_running_other();
+		if (t == NULL) {
+			interrupts_set(enabled);
+			return THREAD_NONE;
+		}
+	} else {
+		t = thread_lookup(tid);
+		if (t == NULL) {
 			interrupts_set(enabled);
 			return THREAD_INVALID;
 		}
+		if (t->state == READY)
+			ready_remove(t);
 	}
 
-	if (current->state == READY)
-	{
-		curr->state=READY;
-		getcontext(curr->tcontext);
-
-			if (context_called==1)
-			{
-				interrupts_set(enabled);
-				return want_tid;
-			}
-
-		context_called=1;
-		curr=current;
-		curr->state=RUNNING;
-		setcontext(curr->tcontext);
-		
-		return curr->id;
+	tid = t->id;
+	if (t->state == READY) {
+		TRACE(TRACE_EXIT, vp_self()->id, tid, curr->id);
+		join_wakeup(t);
+		nr_threads--;
+		if (t->joinable) {
+			t->state = EXIT;
+			stack_free(t->stack);
+			t->stack = NULL;
+		} else {
+			id_free(tid);
+			thread_free(t);
+		}
+	} else {
+		/* a sleeping thread, or one running on another VP, exits the
+		 * next time it is switched to */
+		t->killed = 1;
 	}
+	interrupts_set(enabled);
+	return tid;
+}
 
-	else if (current->state == RUNNING)
-	{
-		interrupts_set(enabled);			
-		return current->id;
-	}
-	
-	//printf("HI\n");
-	return THREAD_FAILED;
+/* set the priority of t, which must not be on a ready queue */
+static void
+prio_set(thread *t, int prio)
+{
+	t->prio = prio;
+	t->ticks = 0;
 }
 
-Tid
-thread_exit(Tid tid)
+/* move every thread back up to its base priority */
+static void
+prio_boost(void)
 {
-	int enabled = interrupts_set(0);
-	thread *current;
-	//thread *temp;
-	current = first;
-
-
-	if (tid==THREAD_ANY)
-	{
-		while(current->state != READY)
-		{
-			current=current->next;
-			if (current==NULL)
-			{
-				interrupts_set(enabled);
-				return THREAD_NONE;
-			}
+	struct vp *vp;
+	thread *t;
+	int i;
+
+	for (i = 0; i < THREAD_MAX_THREADS; i++) {
+		t = threads[i];
+		if (t == NULL || t->prio == t->base_prio)
+			continue;
+		if (t->state == READY) {
+			/* keep it on the ready queues of its VP */
+			vp = t->vp;
+			ready_remove(t);
+			prio_set(t, t->base_prio);
+			queue_push(&vp->ready[t->prio], t);
+			vp->ready_map |= 1U << t->prio;
+		} else {
+			prio_set(t, t->base_prio);
 		}
-		current->state=EXIT;
-		int x=current->id;
-		aid[x]=0; //make ID available 
-		current->id=-99;
-		interrupts_set(enabled);
-		return x;
 	}
+}
 
-	if (first->next==NULL)
-	{
+int
+thread_set_priority(Tid tid, int prio)
+{
+	int enabled = interrupts_set(0);
+	int ret, ready;
+	thread *t;
+
+	t = tid == THREAD_SELF ? curr : thread_lookup(tid);
+	if (t == NULL || t->id == THREAD_NONE || prio < 0 ||
+	    prio >= THREAD_PRIO_LEVELS) {
 		interrupts_set(enabled);
-		return THREAD_NONE;
+		return THREAD_INVALID;
 	}
+	ret = t->base_prio;
+	ready = t->state == READY;
+	if (ready)
+		ready_remove(t);
+	t->base_prio = prio;
+	prio_set(t, prio);
+	if (ready)
+		ready_push(t);
+	interrupts_set(enabled);
+	return ret;
+}
 
+int
+thread_get_priority(Tid tid)
+{
+	int enabled = interrupts_set(0);
+	thread *t;
+	int ret;
 
-	while ((current->id != tid))
-	{
-		current=current->next;
-		if (current==NULL)
-		{
-			interrupts_set(enabled);
-			return THREAD_INVALID;
-		}
-		
+	t = tid == THREAD_SELF ? curr : thread_lookup(tid);
+	ret = t == NULL || t->id == THREAD_NONE ? THREAD_INVALID : t->prio;
+	interrupts_set(enabled);
+	return ret;
+}
+
+int
+thread_preempt(void)
+{
+	int enabled = interrupts_set(0);
+	struct vp *best;
+	thread *t = curr;
+	int ret = 0;
+
+	/* the idle loop looks for threads to run by itself */
+	if (t->id == THREAD_NONE) {
+		interrupts_set(enabled);
+		return -1;
+	}
+	timers_run();
+	if (nr_io_waiters)
+		io_poll(0);
+	if (++nr_ticks % BOOST_TICKS == 0)
+		prio_boost();
+	if (++t->ticks >= PRIO_ALLOT && t->prio < THREAD_PRIO_LEVELS - 1)
+		prio_set(t, t->prio + 1);
+	/* take turns with the threads of the same level, but keep running
+	 * ahead of lower priority threads */
+	best = ready_best();
+	if (t->killed)
+		thread_finish();
+	if (best == NULL)
+		ret = wheel.nr_timers || nr_io_waiters ? 0 : -1;
+	else if (__builtin_ctz(best->ready_map) <= t->prio) {
+		TRACE(TRACE_PREEMPT, vp_self()->id, t->id, 0);
+		ret = thread_yield(THREAD_ANY) >= 0;
+		if (THREAD_STATS)
+			t->preempts += ret;
 	}
+	interrupts_set(enabled);
+	return ret;
+}
 
- 	current->state=EXIT;
- 	int x=current->id;
+/* fill in the statistics of t, including the time in its current state */
+static void
+stats_get(thread *t, struct thread_stats *stats)
+{
+	unsigned long now = stats_now();
+	unsigned long run = t->run, wait = t->wait, sleep = t->sleep;
+	double ns_per_cycle = 0;
+
+	if (t->state == RUNNING)
+		run += now - t->stamp;
+	else if (t->state == READY)
+		wait += now - t->stamp;
+	else if (t->state == SLEEP)
+		sleep += now - t->stamp;
+	/* calibrate the TSC over the time since thread_init */
+	if (now > init_tsc)
+		ns_per_cycle = (double)(now_usecs() * 1000 - init_ns) /
+			(now - init_tsc);
+	stats->run_ns = run * ns_per_cycle;
+	stats->ready_ns = wait * ns_per_cycle;
+	stats->sleep_ns = sleep * ns_per_cycle;
+	stats->switches = t->switches - t->preempts;
+	stats->preempts = t->preempts;
+}
 
-	aid[x]=0;
-	current->id=-99;
+Tid
+thread_stats(Tid tid, struct thread_stats *stats)
+{
+	int enabled = interrupts_set(0);
 
+	if (tid == THREAD_SELF)
+		tid = curr->id;
+	if (tid < 0 || tid >= THREAD_MAX_THREADS || threads[tid] == NULL ||
+	    stats == NULL) {
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	stats_get(threads[tid], stats);
 	interrupts_set(enabled);
-	return x;
-
+	return tid;
 }
 
-void print_rdyq(void)
+void
+print_rdyq(void)
 {
-	thread *current;
-	current = first;
-	while (current!=NULL)
-	{
-	printf("id:%d\n", current->id);
-	printf("state:%d\n", current->state);
-	current=current->next;
+	static const char *states[] = { "READY", "RUNNING", "EXIT", "SLEEP" };
+	int enabled = interrupts_set(0);
+	struct thread_stats stats;
+	thread *t;
+	int i, level;
+
+	for (i = 0; i < nr_vps; i++) {
+		printf("vp %d running: %d\n", i, vps[i].running->id);
+		for (level = 0; level < THREAD_PRIO_LEVELS; level++) {
+			if (vps[i].ready[level].head == NULL)
+				continue;
+			printf("vp %d ready %d:", i, level);
+			for (t = vps[i].ready[level].head; t != NULL;
+			     t = t->next)
+				printf(" %d", t->id);
+			printf("\n");
+		}
+	}
+	printf("tid state prio run_us ready_us sleep_us switches preempts\n");
+	for (i = 0; i < THREAD_MAX_THREADS; i++) {
+		if ((t = threads[i]) == NULL)
+			continue;
+		stats_get(t, &stats);
+		printf("%d %s %d %lu %lu %lu %lu %lu\n", t->id, states[t->state],
+		       t->prio, stats.run_ns / 1000, stats.ready_ns / 1000,
+		       stats.sleep_ns / 1000, stats.switches, stats.preempts);
 	}
+	interrupts_set(enabled);
 }
 
-void thread_stub(void (*thread_main) (void *), void *arg)
+static void
+thread_stub(void (*thread_main) (void *), void *arg)
 {
+	thread_reap();
 	interrupts_set(1);
-	Tid ret;
 	thread_main(arg);
-	ret = thread_exit(THREAD_SELF);
-
-	assert(ret==THREAD_NONE);
-	exit(0);
+	thread_finish();
 }
 
-int tcounter(void)
+/* the stub of threads created by thread_spawn, which keeps the return value
+ * of thread_main as the exit status */
+static void
+thread_spawn_stub(void *(*thread_main) (void *), void *arg)
 {
-	thread *current;
-	current=first;
-	int i = 0;
-
-	if(current==NULL)
-		return -1;
+	void *status;
 
-	while (current->next != NULL)
-	{
-		current=current->next;
-		i++;
-	}
-	return i;
+	thread_reap();
+	interrupts_set(1);
+	status = thread_main(arg);
+	interrupts_set(0);
+	curr->status = status;
+	thread_finish();
 }
 
-int id_calc(void)
+/* exit the running thread, or the process if it is the last thread */
+static void
+thread_finish(void)
 {
-	int j=0;;
-	while (aid[j]!=0) // aid[j]==0 means spot is available
-	{
-		j++;
-	}
+	Tid ret;
 
-	aid[j]=1; //reserve the spot 
-	return j;
+	ret = thread_exit(THREAD_SELF);
+	assert(ret == THREAD_NONE);
+	exit(0);
 }
 
-
 /*******************************************************************
  * Important: The rest of the code should be implemented in Lab 3. *
  *******************************************************************/
 
-/* This is the wait queue structure */
-typedef struct wait_queue {
-	Tid id;
-	struct wait_queue *next;
-	int dummy;
-}wait_queue;
-
+/* This is the wait queue structure. A sleeping thread is not on a ready
+ * queue, so the wait queue links the threads through the same fields. */
+struct wait_queue {
+	struct thread_queue threads;
+};
 
 struct wait_queue *
 wait_queue_create()
 {
-	int enabled = interrupts_set(0);
 	struct wait_queue *wq;
 
 	wq = malloc(sizeof(struct wait_queue));
 	assert(wq);
-	wq->next=NULL;
-	wq->dummy=0;
-
-	interrupts_set(enabled);
+	wq->threads.head = NULL;
+	wq->threads.tail = NULL;
 	return wq;
 }
 
 void
 wait_queue_destroy(struct wait_queue *wq)
 {
-	TBD();
+	assert(wq->threads.head == NULL);
 	free(wq);
 }
 
+/* take t off the wait queue it sleeps in, and make it READY */
+static void
+wait_wake(thread *t)
+{
+	queue_remove(&t->waiting->threads, t);
+	t->waiting = NULL;
+	wheel_cancel(&wheel, &t->timer);
+	ready_push(t);
+}
+
+/* suspend the calling thread in queue, or in no queue if it is NULL, until it
+ * is woken up or, if usecs is not negative, until usecs microseconds have
+ * passed. Called with interrupts disabled. Returns like thread_sleep. */
+static Tid
+sleep_timed(struct wait_queue *queue, long usecs)
+{
+	thread *next;
+	Tid ret;
+
+	if (usecs >= 0) {
+		/* the idle loop wakes us up if nothing else runs */
+		if (vp0_idle_init() < 0)
+			return THREAD_NOMEMORY;
+		wheel_add(&wheel, &curr->timer, now_usecs() + usecs);
+	}
+	next = sched_next();
+	if (next == NULL)
+		return THREAD_NONE;
+	if (queue) {
+		queue_push(&queue->threads, curr);
+		curr->waiting = queue;
+	}
+	curr->timed_out = 0;
+
+	/* when this VP goes idle, no other thread ran here */
+	ret = next->id == THREAD_NONE ? curr->id : next->id;
+	TRACE(TRACE_SLEEP, vp_self()->id, curr->id, usecs);
+	curr->state = SLEEP;
+	if (usecs >= 0)
+		interrupts_start();
+	thread_switch(next);
+	return ret;
+}
+
 Tid
 thread_sleep(struct wait_queue *queue)
 {
 	int enabled = interrupts_set(0);
-	thread *current;
-	current=first;
+	Tid ret;
 
-	wait_queue *q_current;
-	q_current=queue;
-	
+	if (queue == NULL) {
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	ret = sleep_timed(queue, -1);
+	interrupts_set(enabled);
+	return ret;
+}
 
-	int context_called = 0;
+int
+thread_sleep_for(long usecs)
+{
+	int enabled = interrupts_set(0);
+	Tid ret;
 
-	if (queue==NULL)
-	{
+	if (usecs < 0) {
 		interrupts_set(enabled);
 		return THREAD_INVALID;
-	}	
-
-	//find a thread that is ready, if none return THREAD_NONE
-	while(current->state != READY)
-	{
-		current=current->next;
-		if (current==NULL)
-		{
-			interrupts_set(enabled);
-			return THREAD_NONE;
-		}
 	}
+	ret = sleep_timed(NULL, usecs);
+	interrupts_set(enabled);
+	return thread_ret_ok(ret) ? 0 : ret;
+}
 
-	//At this point, current is pointing at ready thread
+/* The threads waiting for a file descriptor. The descriptor is in the epoll
+ * set with EPOLLONESHOT, for the events that its waiters want, and is armed
+ * again whenever a thread starts waiting and after each event that leaves
+ * waiters behind. An event wakes up one waiter of each direction that is
+ * ready, which tries its system call again, so that waiters do not stampede.
+ * Errors and hangups wake up all of them. */
+struct fd_waiters {
+	struct wait_queue readers;
+	struct wait_queue writers;
+};
 
-	//set current running thread's state to sleep.
-	curr->state=SLEEP;
+/* returns the waiters of fd, or NULL if there is no memory for them */
+static struct fd_waiters *
+fd_waiters_get(int fd)
+{
+	struct fd_waiters **table;
+	int size;
+
+	if (fd >= fd_table_size) {
+		size = fd_table_size ? fd_table_size : 64;
+		while (size <= fd)
+			size *= 2;
+		table = realloc(fd_table, size * sizeof(*table));
+		if (table == NULL)
+			return NULL;
+		while (fd_table_size < size)
+			table[fd_table_size++] = NULL;
+		fd_table = table;
+	}
+	if (fd_table[fd] == NULL)
+		fd_table[fd] = calloc(1, sizeof(struct fd_waiters));
+	return fd_table[fd];
+}
 
-	getcontext(curr->tcontext);
+/* arm fd for the events of its waiters, and events. returns -1 and sets errno
+ * if epoll cannot wait for fd. */
+static int
+io_arm(int fd, struct fd_waiters *w, unsigned int events)
+{
+	struct epoll_event ev;
+
+	ev.events = events | EPOLLONESHOT;
+	if (w->readers.threads.head)
+		ev.events |= EPOLLIN;
+	if (w->writers.threads.head)
+		ev.events |= EPOLLOUT;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0)
+		return 0;
+	/* not added yet, or closed and opened again since */
+	if (errno != ENOENT)
+		return -1;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
 
-	if (context_called==1)
-	{
-		interrupts_set(enabled);
-		return curr->id;
+/* wake up the first thread in queue, or all of them */
+static void
+io_wake(struct wait_queue *queue, int all)
+{
+	while (queue->threads.head != NULL) {
+		wait_wake(queue->threads.head);
+		nr_io_waiters--;
+		if (!all)
+			break;
 	}
-	
-	context_called=1;
+}
 
-	//only runs when there is 0 threads in the sleep queue. 
-	//malloc not required
-	if (queue->dummy == 0)
-	{
-		queue->dummy=1;
-		queue->id=curr->id;
-		queue->next=NULL;
+/* wake up the threads whose file descriptors are ready, waiting up to nsecs
+ * for one to be, or for a kick. Called with interrupts disabled, which are
+ * enabled while waiting. */
+static void
+io_poll(long nsecs)
+{
+	struct timespec timeout = { 0, nsecs };
+	struct epoll_event evs[IO_EVENTS];
+	struct fd_waiters *w;
+	int i, n, fd, all;
+	uint64_t kick;
+
+	if (nsecs)
+		interrupts_set(1);
+	n = epoll_pwait2(epfd, evs, IO_EVENTS, &timeout, NULL);
+	if (nsecs)
+		interrupts_set(0);
+	for (i = 0; i < n; i++) {
+		fd = evs[i].data.fd;
+		if (fd == kick_fd) {
+			/* kicks are for idle VPs, the timer interrupt
+			 * leaves them to one */
+			if (nsecs && read(kick_fd, &kick, sizeof(kick)) > 0)
+				nr_kicks--;
+			continue;
+		}
+		w = fd_table[fd];
+		all = evs[i].events & (EPOLLERR | EPOLLHUP);
+		if (evs[i].events & EPOLLIN || all)
+			io_wake(&w->readers, all);
+		if (evs[i].events & EPOLLOUT || all)
+			io_wake(&w->writers, all);
+		if (w->readers.threads.head || w->writers.threads.head)
+			io_arm(fd, w, 0);
 	}
+}
 
-	//Add current running thread at the end.
-	else
-	{
-		while(q_current->next != NULL)
-		{
-			q_current=q_current->next;
-		}
-	q_current->next=malloc(sizeof(struct wait_queue));
-	q_current=q_current->next;
-	q_current->id=curr->id;
-	q_current->dummy=1;
-	q_current->next=NULL;
+int
+thread_wait_fd(int fd, int write)
+{
+	int enabled = interrupts_set(0);
+	struct fd_waiters *w;
+	Tid ret;
+
+	if (fd < 0) {
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	/* the idle loop polls for us if nothing else runs */
+	if (vp0_idle_init() < 0 || (w = fd_waiters_get(fd)) == NULL) {
+		interrupts_set(enabled);
+		return THREAD_NOMEMORY;
+	}
+	if (io_arm(fd, w, write ? EPOLLOUT : EPOLLIN) < 0) {
+		interrupts_set(enabled);
+		return THREAD_FAILED;
+	}
+	nr_io_waiters++;
+	/* poll on the timer interrupts while other threads run */
+	interrupts_start();
+	ret = sleep_timed(write ? &w->writers : &w->readers, -1);
+	interrupts_set(enabled);
+	return thread_ret_ok(ret) ? 0 : ret;
+}
 
+/* wake up the threads at the head of queue that were destroyed while they
+ * slept in it, so that they exit, and return how many there were */
+static int
+wait_reap(struct wait_queue *queue)
+{
+	thread *t;
+	int nr = 0;
+
+	while ((t = queue->threads.head) != NULL && t->killed) {
+		wait_wake(t);
+		nr++;
 	}
-	
-	curr=current;
-	curr->state=RUNNING;
-	setcontext(curr->tcontext);
+	return nr;
+}
+
+int
+wait_queue_reap(struct wait_queue *queue)
+{
+	int enabled = interrupts_set(0);
+	int nr = wait_reap(queue);
 
 	interrupts_set(enabled);
-	return curr->id;
+	return nr;
 }
 
 /* when the 'all' parameter is 1, wakeup all threads waiting in the queue.
- * returns whether a thread was woken up on not. */
+ * returns the number of threads that were woken up. */
 int
 thread_wakeup(struct wait_queue *queue, int all)
 {
 	int enabled = interrupts_set(0);
-	thread *current;
-	current = first;
-
-	wait_queue *q_current;
-	q_current=queue;
-
-	int counter=0;
+	thread *t;
+	int nr = 0;
 
-	if (queue==NULL)
+	if (queue == NULL) {
 		interrupts_set(enabled);
-		return counter;
-
-	// dummy=0 means wait queue has been initialized but nothing has been added to wait queue.
-	if (queue->dummy==0)
-		interrupts_set(enabled);
-		return counter;
-
-	//wake up the the first thread(head) in the sleep queue.
-	if (all==0)
-	{
-		//make current point to the corresponding id in main linked list
-		while (current->id != q_current->id)
-		{
-			current=current->next;
-			if (current==NULL)
-			{
-				interrupts_set(enabled);
-				return counter;
-			}
-		}
+		return 0;
+	}
+	while ((t = queue->threads.head) != NULL) {
+		assert(t->state == SLEEP);
+		wait_wake(t);
+		nr++;
+		if (!all)
+			break;
+	}
+	interrupts_set(enabled);
+	return nr;
+}
 
+/* wake up the threads waiting in thread_join for t, which is exiting, and
+ * pass them its exit status. t is then no longer joinable. */
+static void
+join_wakeup(thread *t)
+{
+	thread *joiner;
+
+	if (t->joiners == NULL || t->joiners->threads.head == NULL)
+		return;
+	for (joiner = t->joiners->threads.head; joiner != NULL;
+	     joiner = joiner->next)
+		joiner->joined = t->status;
+	thread_wakeup(t->joiners, 1);
+	wait_queue_destroy(t->joiners);
+	t->joiners = NULL;
+	t->joinable = 0;
+}
 
-		current->state=READY;
-		queue=queue->next;
-		free(q_current);
+Tid
+thread_join(Tid tid, void **status)
+{
+	int enabled = interrupts_set(0);
+	thread *t;
+	Tid ret;
 
+	if (tid < 0 || tid >= THREAD_MAX_THREADS || threads[tid] == NULL ||
+	    threads[tid] == curr) {
 		interrupts_set(enabled);
-		return 1;
+		return THREAD_INVALID;
 	}
-
-	if (all==1)
-	{
-
-		//wake up(put in ready state) for every thread in sleep queue.
-		while (q_current != NULL)
-		{
-		q_current=queue;
-		current=first;
-
-			while(q_current->id != current->id)
-			{
-				current=current->next;
-			}
-		current->state=READY;
-		queue=queue->next;
-		free(q_current);
-		q_current=queue;
-
-		counter++;
-		}
-
-	interrupts_set(enabled);
-	return counter;
+	t = threads[tid];
+	if (t->state == EXIT) {
+		/* a joinable thread that has exited already */
+		if (status)
+			*status = t->status;
+		id_free(tid);
+		thread_free(t);
+		interrupts_set(enabled);
+		return tid;
 	}
-interrupts_set(enabled);
-return 0;
+	if (t->joiners == NULL)
+		t->joiners = wait_queue_create();
+	/* t is gone by the time we run again */
+	ret = thread_sleep(t->joiners);
+	if (thread_ret_ok(ret)) {
+		ret = tid;
+		if (status)
+			*status = curr->joined;
+	}
+	interrupts_set(enabled);
+	return ret;
 }
 
+/* A lock is free when it has no owner. Acquiring a free lock and releasing a
+ * lock that no thread waits for only set the owner. Otherwise, the releasing
+ * thread hands the lock to the first waiter, which wakes up owning it, so that
+ * the lock is granted in FIFO order and no other thread can take it in
+ * between. */
 struct lock {
-	/* ... Fill this in ... */
+	thread *owner;
+	struct wait_queue waiters;
 };
 
 struct lock *
@@ -542,7 +1414,9 @@ lock_create()
 	lock = malloc(sizeof(struct lock));
 	assert(lock);
 
-	TBD();
+	lock->owner = NULL;
+	lock->waiters.threads.head = NULL;
+	lock->waiters.threads.tail = NULL;
 
 	return lock;
 }
@@ -552,7 +1426,8 @@ lock_destroy(struct lock *lock)
 {
 	assert(lock != NULL);
 
-	TBD();
+	assert(lock->owner == NULL);
+	assert(lock->waiters.threads.head == NULL);
 
 	free(lock);
 }
@@ -560,21 +1435,58 @@ lock_destroy(struct lock *lock)
 void
 lock_acquire(struct lock *lock)
 {
+	int enabled = interrupts_set(0);
+	Tid ret;
+
 	assert(lock != NULL);
+	if (lock->owner == NULL) {
+		lock->owner = curr;
+	} else {
+		assert(lock->owner != curr);
+		TRACE(TRACE_LOCK_CONTEND, vp_self()->id, curr->id, lock);
+		ret = sleep_timed(&lock->waiters, -1);
+		assert(thread_ret_ok(ret));
+		/* lock_release handed the lock to us */
+		assert(lock->owner == curr);
+	}
+	TRACE(TRACE_LOCK_ACQUIRE, vp_self()->id, curr->id, lock);
+	interrupts_set(enabled);
+}
 
-	TBD();
+/* give lock, which the running thread owns, to its first waiter, or make it
+ * free if there is none */
+static void
+lock_handoff(struct lock *lock)
+{
+	thread *t;
+
+	/* threads destroyed while waiting exit instead of taking the lock */
+	wait_reap(&lock->waiters);
+	t = lock->waiters.threads.head;
+	lock->owner = t;
+	if (t)
+		wait_wake(t);
 }
 
 void
 lock_release(struct lock *lock)
 {
-	assert(lock != NULL);
+	int enabled = interrupts_set(0);
 
-	TBD();
+	assert(lock != NULL);
+	assert(lock->owner == curr);
+	TRACE(TRACE_LOCK_RELEASE, vp_self()->id, curr->id, lock);
+	lock_handoff(lock);
+	interrupts_set(enabled);
 }
 
+/* A condition variable is a queue of the threads waiting on it. cv_signal and
+ * cv_broadcast are called with the lock held, so rather than making the
+ * waiters READY only for them to block again on the lock, they move the
+ * waiters onto the lock's wait queue (wait morphing). Each waiter then wakes
+ * up once, when lock_release hands it the lock. */
 struct cv {
-	/* ... Fill this in ... */
+	struct wait_queue waiters;
 };
 
 struct cv *
@@ -585,7 +1497,8 @@ cv_create()
 	cv = malloc(sizeof(struct cv));
 	assert(cv);
 
-	TBD();
+	cv->waiters.threads.head = NULL;
+	cv->waiters.threads.tail = NULL;
 
 	return cv;
 }
@@ -595,34 +1508,107 @@ cv_destroy(struct cv *cv)
 {
 	assert(cv != NULL);
 
-	TBD();
+	assert(cv->waiters.threads.head == NULL);
 
 	free(cv);
 }
 
+/* release lock and wait on cv until it is signalled or, if usecs is not
+ * negative, until usecs microseconds have passed, and then own lock again.
+ * Returns like cv_timedwait, or THREAD_NONE if nothing could wake the
+ * thread up. */
+static int
+cv_sleep(struct cv *cv, struct lock *lock, long usecs)
+{
+	int enabled = interrupts_set(0);
+	int timed_out;
+	Tid ret;
+
+	assert(lock->owner == curr);
+	/* fail while the thread still owns lock, since handing it off cannot
+	 * be undone. the handoff makes a waiter READY, if there is one, and
+	 * a timed sleep can always wait in the idle loop. */
+	if (usecs >= 0 && vp0_idle_init() < 0) {
+		interrupts_set(enabled);
+		return THREAD_NOMEMORY;
+	}
+	if (usecs < 0 && lock->waiters.threads.head == NULL &&
+	    ready_best() == NULL && !idle_can_wait()) {
+		interrupts_set(enabled);
+		return THREAD_NONE;
+	}
+	lock_handoff(lock);
+	ret = sleep_timed(&cv->waiters, usecs);
+	assert(thread_ret_ok(ret));
+	timed_out = curr->timed_out;
+	if (timed_out) {
+		/* woken up by the timer without the lock */
+		lock_acquire(lock);
+	}
+	/* otherwise lock_release handed the lock to us */
+	assert(lock->owner == curr);
+	interrupts_set(enabled);
+	return !timed_out;
+}
+
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
+	int ret;
+
 	assert(cv != NULL);
 	assert(lock != NULL);
 
-	TBD();
+	/* no thread could ever signal cv */
+	ret = cv_sleep(cv, lock, -1);
+	assert(ret != THREAD_NONE);
+}
+
+int
+cv_timedwait(struct cv *cv, struct lock *lock, long usecs)
+{
+	assert(cv != NULL);
+	assert(lock != NULL);
+
+	return cv_sleep(cv, lock, usecs < 0 ? 0 : usecs);
+}
+
+/* move t from the condition variable it waits on to the waiters of lock,
+ * which the running thread owns */
+static void
+cv_morph(thread *t, struct lock *lock)
+{
+	queue_remove(&t->waiting->threads, t);
+	/* a timeout no longer applies once t is signalled */
+	wheel_cancel(&wheel, &t->timer);
+	queue_push(&lock->waiters.threads, t);
+	t->waiting = &lock->waiters;
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
+	int enabled = interrupts_set(0);
+
 	assert(cv != NULL);
 	assert(lock != NULL);
+	assert(lock->owner == curr);
 
-	TBD();
+	if (cv->waiters.threads.head)
+		cv_morph(cv->waiters.threads.head, lock);
+	interrupts_set(enabled);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
+	int enabled = interrupts_set(0);
+
 	assert(cv != NULL);
 	assert(lock != NULL);
+	assert(lock->owner == curr);
 
-	TBD();
+	while (cv->waiters.threads.head)
+		cv_morph(cv->waiters.threads.head, lock);
+	interrupts_set(enabled);
 }
@@ -4,6 +4,8 @@
 typedef int Tid;
 #define THREAD_MAX_THREADS 1024
 #define THREAD_MIN_STACK 32768
+#define THREAD_MAX_VPS 64
+#define THREAD_PRIO_LEVELS 8
 
 /*
  * Valid thread identifiers (Tid) range between 0 and THREAD_MAX_THREADS-1. The
@@ -44,6 +46,29 @@ Tid thread_id();
  * THREAD_NOMEMORY: no more memory available to create a thread stack. */
 Tid thread_create(void (*fn) (void *), void *arg);
 
+/* like thread_create, but the value that fn returns is the exit status of the
+ * thread, which thread_join returns. The thread keeps its identifier after it
+ * exits, until it is joined. */
+Tid thread_spawn(void *(*fn) (void *), void *arg);
+
+/* the time a thread has spent in each state, and how often it was switched
+ * out, either because it gave up the processor or because the timer interrupt
+ * preempted it */
+struct thread_stats {
+	unsigned long run_ns;	/* running */
+	unsigned long ready_ns;	/* ready, waiting to run */
+	unsigned long sleep_ns;	/* in a wait queue, or sleeping for a time */
+	unsigned long switches;	/* gave up the processor */
+	unsigned long preempts;	/* preempted by the timer interrupt */
+};
+
+/* fill in stats for the thread tid, or for the calling thread if tid is
+ * THREAD_SELF, up to now. The times are measured with the TSC. With the
+ * library built with -DTHREAD_STATS=0, all of them are 0. Returns tid, or
+ * THREAD_INVALID if there is no thread tid. print_rdyq() prints them for all
+ * threads. */
+Tid thread_stats(Tid tid, struct thread_stats *stats);
+
 /* suspend calling thread and run the thread with identifier tid. The calling
  * thread is put in the ready queue. tid can be identifier of any available
  * thread or the following constants:
@@ -81,6 +106,44 @@ Tid thread_yield(Tid tid);
  *		   or THREAD_SELF. */
 Tid thread_exit(Tid tid);
 
+/* run threads on n virtual processors, i.e., kernel threads, instead of one,
+ * so that they can run in parallel. may be called once, after thread_init. A
+ * thread may continue on another virtual processor after any call that can
+ * switch threads, or after being preempted. Disabling interrupts then also
+ * excludes threads running on other virtual processors. Returns n on success,
+ * or the following:
+ *
+ * THREAD_INVALID: n is out of range, or the function was called before.
+ * THREAD_NOMEMORY: no more memory available.
+ * THREAD_FAILED: not all kernel threads could be created. */
+int thread_set_vps(int n);
+
+/* suspend the calling thread until the thread with identifier tid exits. Any
+ * number of threads can wait for the same thread. Upon success, return tid and,
+ * if status is not NULL, store the exit status of the thread in *status. This
+ * is the value returned by the function passed to thread_spawn, and NULL for
+ * threads created by thread_create or destroyed by thread_exit. Upon failure,
+ * return the following:
+ *
+ * THREAD_INVALID: tid is the caller, or does not correspond to a valid thread.
+ *		   This includes a thread from thread_create that has exited,
+ *		   and a thread from thread_spawn that has been joined.
+ * THREAD_NONE:	   no other thread is available to run. */
+Tid thread_join(Tid tid, void **status);
+
+/* Threads are scheduled by priority, from level 0, the highest, to level
+ * THREAD_PRIO_LEVELS-1. A thread that keeps running through timer interrupts
+ * moves down to lower levels, while a thread that often sleeps or yields stays
+ * at its level. All threads move back up to their base priority
+ * periodically. A thread is created with base priority 0.
+ *
+ * thread_set_priority sets the base priority of thread tid (or THREAD_SELF) to
+ * prio, and moves it to that level. It returns the previous base priority.
+ * thread_get_priority returns the current level of tid. Both return
+ * THREAD_INVALID when tid or prio are not valid. */
+int thread_set_priority(Tid tid, int prio);
+int thread_get_priority(Tid tid);
+
 /********************************************
  * Lab 3: Implement the following functions *
  ********************************************/
@@ -111,6 +174,31 @@ Tid thread_sleep(struct wait_queue *queue);
  * return zero if there were no suspended threads in the wait queue. */
 int thread_wakeup(struct wait_queue *queue, int all);
 
+/* wake up the threads at the head of the wait queue that were destroyed by
+ * thread_exit while they slept in it, so that they exit. Returns how many
+ * there were. The next thread that thread_wakeup wakes up is then one that
+ * was not destroyed, so code that hands something over to the threads it
+ * wakes up calls this first. */
+int wait_queue_reap(struct wait_queue *queue);
+
+/* suspend the calling thread for at least usecs microseconds, while other
+ * threads run. Returns 0 after sleeping, or the following:
+ *
+ * THREAD_INVALID: usecs is negative.
+ * THREAD_NOMEMORY: no memory to run the idle loop while no thread runs. */
+int thread_sleep_for(long usecs);
+
+/* suspend the calling thread until fd is ready for reading, when write is 0,
+ * or for writing, when write is 1, while other threads run. The file
+ * descriptor should be in non-blocking mode, and be waited for after a system
+ * call on it fails with EAGAIN. Returns 0 when it may be ready, or the
+ * following:
+ *
+ * THREAD_INVALID: fd is negative.
+ * THREAD_NOMEMORY: no memory to keep track of fd.
+ * THREAD_FAILED: epoll cannot wait for fd, with errno set by epoll_ctl. */
+int thread_wait_fd(int fd, int write);
+
 /* create a blocking lock. initially, the lock is available. associate a wait
  * queue with the lock so that threads that need to acquire the lock can wait in
  * this queue. */
@@ -123,8 +211,9 @@ void lock_destroy(struct lock *lock);
  * lock. */
 void lock_acquire(struct lock *lock);
 /* release the lock. be sure to check that the lock had been acquired by the
- * calling thread, before it is released. wakeup all threads that are waiting to
- * acquire the lock. */
+ * calling thread, before it is released. the lock is handed directly to the
+ * thread that has waited for it the longest, which wakes up owning it, so the
+ * waiters acquire the lock in FIFO order. */
 void lock_release(struct lock *lock);
 
 /* create a condition variable. associate a wait queue with the condition
@@ -139,6 +228,13 @@ void cv_destroy(struct cv *cv);
  * from wait. */
 void cv_wait(struct cv *cv, struct lock *lock);
 
+/* like cv_wait, but stop waiting after usecs microseconds. the lock is
+ * acquired again in either case. Returns 1 if the thread was woken up by
+ * cv_signal or cv_broadcast, and 0 if it timed out. Returns THREAD_NOMEMORY,
+ * still holding the lock, if there is no memory to run the idle loop while no
+ * thread runs. */
+int cv_timedwait(struct cv *cv, struct lock *lock, long usecs);
+
 /* wake up one thread that is waiting on the condition variable cv. be sure to
  * check that the calling thread had acquired lock when this call is made. */
 void cv_signal(struct cv *cv, struct lock *lock);
@@ -0,0 +1,79 @@
+#include <errno.h>
+#include <unistd.h>
+#include "thread.h"
+#include "thread_io.h"
+
+/* returns whether the system call that failed with errno would have blocked,
+ * after waiting until fd may be ready for reading or writing. otherwise,
+ * errno holds the error to return. */
+static int
+io_wait(int fd, int write)
+{
+	int ret;
+
+	if (errno == EINTR)
+		return 1;
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+		return 0;
+	ret = thread_wait_fd(fd, write);
+	if (ret == THREAD_NOMEMORY)
+		errno = ENOMEM;
+	else if (ret == THREAD_INVALID)
+		errno = EBADF;
+	return ret == 0;
+}
+
+ssize_t
+thread_read(int fd, void *buf, size_t count)
+{
+	ssize_t n;
+
+	while ((n = read(fd, buf, count)) < 0 && io_wait(fd, 0))
+		;
+	return n;
+}
+
+ssize_t
+thread_write(int fd, const void *buf, size_t count)
+{
+	ssize_t n;
+
+	while ((n = write(fd, buf, count)) < 0 && io_wait(fd, 1))
+		;
+	return n;
+}
+
+int
+thread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+	int sock;
+
+	while ((sock = accept4(fd, addr, addrlen, SOCK_NONBLOCK)) < 0 &&
+	       io_wait(fd, 0))
+		;
+	return sock;
+}
+
+int
+thread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+	socklen_t len = sizeof(int);
+	int err;
+
+	if (connect(fd, addr, addrlen) == 0)
+		return 0;
+	/* the connection is made in the background, and the socket becomes
+	 * writable when it is done */
+	if (errno != EINPROGRESS && errno != EINTR)
+		return -1;
+	errno = EAGAIN;
+	if (!io_wait(fd, 1))
+		return -1;
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		return -1;
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
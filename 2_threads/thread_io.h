@@ -0,0 +1,22 @@
+#ifndef _THREAD_IO_H_
+#define _THREAD_IO_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/* Thread-aware versions of the blocking I/O system calls. Each one works like
+ * the system call, except that where it would block, only the calling thread
+ * waits, in thread_wait_fd, while other threads run. The file descriptors
+ * must be in non-blocking mode (O_NONBLOCK). They return -1 and set errno on
+ * failure, with ENOMEM if the thread cannot wait for the descriptor. */
+
+ssize_t thread_read(int fd, void *buf, size_t count);
+ssize_t thread_write(int fd, const void *buf, size_t count);
+
+/* the new socket is in non-blocking mode, ready for the functions here */
+int thread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+/* returns once the connection has been made, or has failed */
+int thread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+#endif /* _THREAD_IO_H_ */
@@ -0,0 +1,178 @@
+#include <assert.h>
+#include <stddef.h>
+#include "timer_wheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+/* the furthest a timer can be placed from the current tick */
+#define WHEEL_RANGE ((1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+void
+wheel_init(struct timer_wheel *w, unsigned long now)
+{
+	int i, j;
+
+	w->now = now;
+	w->nr_timers = 0;
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		w->map[i] = 0;
+		for (j = 0; j < WHEEL_SLOTS; j++)
+			w->slots[i][j] = NULL;
+	}
+}
+
+void
+wheel_timer_init(struct wheel_timer *t)
+{
+	t->level = -1;
+	t->prev = NULL;
+	t->next = NULL;
+}
+
+/* put t in the slot for t->expires, relative to the current tick */
+static void
+wheel_place(struct timer_wheel *w, struct wheel_timer *t)
+{
+	unsigned long expires = t->expires;
+	unsigned long delta = expires - w->now;
+	struct wheel_timer **slot;
+	int level;
+
+	if (delta > WHEEL_RANGE) {
+		/* found again by a cascade of the last slot */
+		delta = WHEEL_RANGE;
+		expires = w->now + delta;
+	}
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < 1UL << (WHEEL_BITS * (level + 1)))
+			break;
+	}
+	t->level = level;
+	t->slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	slot = &w->slots[level][t->slot];
+	t->prev = NULL;
+	t->next = *slot;
+	if (*slot)
+		(*slot)->prev = t;
+	*slot = t;
+	w->map[level] |= 1UL << t->slot;
+}
+
+static void
+wheel_unlink(struct timer_wheel *w, struct wheel_timer *t)
+{
+	struct wheel_timer **slot = &w->slots[t->level][t->slot];
+
+	if (t->prev)
+		t->prev->next = t->next;
+	else
+		*slot = t->next;
+	if (t->next)
+		t->next->prev = t->prev;
+	if (*slot == NULL)
+		w->map[t->level] &= ~(1UL << t->slot);
+	t->level = -1;
+}
+
+void
+wheel_add(struct timer_wheel *w, struct wheel_timer *t, unsigned long expires)
+{
+	assert(!wheel_timer_pending(t));
+	t->expires = expires < w->now ? w->now : expires;
+	wheel_place(w, t);
+	w->nr_timers++;
+}
+
+void
+wheel_cancel(struct timer_wheel *w, struct wheel_timer *t)
+{
+	if (!wheel_timer_pending(t))
+		return;
+	wheel_unlink(w, t);
+	w->nr_timers--;
+}
+
+/* move the timers of a slot of a higher level down to the lower levels */
+static void
+wheel_cascade(struct timer_wheel *w, int level, int idx)
+{
+	struct wheel_timer *t, *next;
+
+	t = w->slots[level][idx];
+	w->slots[level][idx] = NULL;
+	w->map[level] &= ~(1UL << idx);
+	for (; t != NULL; t = next) {
+		next = t->next;
+		wheel_place(w, t);
+	}
+}
+
+/* returns map rotated right by off slots */
+static inline unsigned long
+map_rotate(unsigned long map, int off)
+{
+	return off ? map >> off | map << (WHEEL_SLOTS - off) : map;
+}
+
+/* returns the next tick, from the current one on, that has timers to expire
+ * or a cascade of a busy slot, or ~0UL if there are no timers */
+unsigned long
+wheel_next(struct timer_wheel *w)
+{
+	unsigned long next = ~0UL;
+	unsigned long map, first;
+	int level, shift;
+
+	if (w->nr_timers == 0)
+		return ~0UL;
+	/* bit i of the map is the slot of tick now + i */
+	map = map_rotate(w->map[0], w->now & WHEEL_MASK);
+	if (map)
+		next = w->now + __builtin_ctzl(map);
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		/* bit i of the map is the slot that starts at the i-th slot
+		 * boundary of the level from the current tick on, where it is
+		 * cascaded */
+		shift = WHEEL_BITS * level;
+		first = (w->now + (1UL << shift) - 1) >> shift;
+		map = map_rotate(w->map[level], first & WHEEL_MASK);
+		if (map && (first + __builtin_ctzl(map)) << shift < next)
+			next = (first + __builtin_ctzl(map)) << shift;
+	}
+	return next;
+}
+
+struct wheel_timer *
+wheel_advance(struct timer_wheel *w, unsigned long now)
+{
+	struct wheel_timer *head = NULL, *tail = NULL;
+	struct wheel_timer *t;
+	unsigned long tick;
+	int level, idx;
+
+	while ((tick = wheel_next(w)) <= now) {
+		w->now = tick;
+		if ((tick & WHEEL_MASK) == 0) {
+			for (level = 1; level < WHEEL_LEVELS; level++) {
+				idx = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+				wheel_cascade(w, level, idx);
+				if (idx != 0)
+					break;
+			}
+		}
+		idx = tick & WHEEL_MASK;
+		while ((t = w->slots[0][idx]) != NULL) {
+			wheel_unlink(w, t);
+			w->nr_timers--;
+			t->next = NULL;
+			if (tail)
+				tail->next = t;
+			else
+				head = t;
+			tail = t;
+		}
+		w->now = tick + 1;
+	}
+	if (w->now <= now)
+		w->now = now + 1;
+	return head;
+}
@@ -0,0 +1,63 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+/* A hierarchical timer wheel. Time is counted in ticks, of whatever length
+ * the caller chooses. Level 0 has a slot for each of the next WHEEL_SLOTS
+ * ticks, and each slot of level i covers WHEEL_SLOTS slots of level i-1. A
+ * timer is put in the slot of the lowest level that reaches its expiry time,
+ * and moves down a level each time the wheel turns past the start of its slot
+ * (a cascade). Adding and cancelling a timer are O(1), and advancing the
+ * wheel skips over empty slots using a bitmap of the busy slots of each
+ * level. Timers further away than the highest level are kept in its last slot
+ * until they come in range. */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+struct wheel_timer {
+	unsigned long expires;	/* the tick at which the timer expires */
+	int level;		/* where it is in the wheel, or -1 */
+	int slot;
+	struct wheel_timer *prev;
+	struct wheel_timer *next;
+};
+
+struct timer_wheel {
+	unsigned long now;	/* the next tick to process */
+	int nr_timers;
+	unsigned long map[WHEEL_LEVELS];	/* busy slots of each level */
+	struct wheel_timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+/* start an empty wheel at tick now */
+void wheel_init(struct timer_wheel *w, unsigned long now);
+
+/* set up a timer that is not in any wheel */
+void wheel_timer_init(struct wheel_timer *t);
+
+/* returns whether t is in a wheel */
+static inline int
+wheel_timer_pending(struct wheel_timer *t)
+{
+	return t->level >= 0;
+}
+
+/* add t, which must not be pending, to expire at tick expires. A timer that
+ * expires before the current tick expires at the current tick. */
+void wheel_add(struct timer_wheel *w, struct wheel_timer *t,
+	       unsigned long expires);
+
+/* remove t from the wheel, if it is pending */
+void wheel_cancel(struct timer_wheel *w, struct wheel_timer *t);
+
+/* turn the wheel up to and including tick now, and return the timers that
+ * expired, linked through their next field, in the order they expired. The
+ * returned timers are no longer pending. */
+struct wheel_timer *wheel_advance(struct timer_wheel *w, unsigned long now);
+
+/* returns a tick at or before which the next timer expires. This is either
+ * the exact expiry time, or the cascade of the slot it is in, at which it may
+ * be found to expire later. Returns ~0UL if there are no timers. */
+unsigned long wheel_next(struct timer_wheel *w);
+
+#endif /* _TIMER_WHEEL_H_ */
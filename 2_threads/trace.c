@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <time.h>
+#include <x86intrin.h>
+#include "thread.h"
+#include "trace.h"
+
+#define TRACE_MASK (TRACE_EVENTS - 1)
+
+int trace_enabled;
+
+/* event i is in ring[i % TRACE_EVENTS] until it is overwritten. head is the
+ * number of events recorded since trace_start. */
+static struct trace_event ring[TRACE_EVENTS];
+static unsigned long head;
+/* the TSC and the monotonic clock at trace_start, to convert TSC cycles to
+ * microseconds */
+static unsigned long start_tsc;
+static double start_us;
+/* the TSC at trace_stop */
+static unsigned long stop_tsc;
+
+static const char *trace_names[TRACE_TYPES] = {
+	"create", "run", "yield", "preempt", "sleep", "wakeup",
+	"lock_acquire", "lock_contend", "lock_release", "exit",
+};
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Each event claims its slot with an atomic increment of head, and then sets
+ * its seq last, so that trace_export can skip a slot that is being written,
+ * or that was overwritten, while it reads it. */
+void
+trace_record(int type, int vp, int tid, long arg)
+{
+	unsigned long i = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+	struct trace_event *e = &ring[i & TRACE_MASK];
+
+	__atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	e->tsc = __rdtsc();
+	e->arg = arg;
+	e->tid = tid;
+	e->type = type;
+	e->vp = vp;
+	__atomic_store_n(&e->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+void
+trace_start(void)
+{
+	trace_enabled = 0;
+	head = 0;
+	start_tsc = __rdtsc();
+	start_us = now_us();
+	__atomic_store_n(&trace_enabled, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+trace_stop(void)
+{
+	__atomic_store_n(&trace_enabled, 0, __ATOMIC_SEQ_CST);
+	stop_tsc = __rdtsc();
+}
+
+static void
+trace_name(FILE *f, int vp)
+{
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+		"\"args\":{\"name\":\"vp %d\"}}", vp, vp);
+}
+
+/* write the slice of the thread that ran on vp from since[vp] until ts */
+static void
+trace_slice(FILE *f, int vp, int tid, double since, double ts)
+{
+	/* the idle loop is left out */
+	if (tid == THREAD_INVALID || tid == THREAD_NONE)
+		return;
+	fprintf(f, ",\n{\"name\":\"run\",\"ph\":\"X\",\"ts\":%.3f,"
+		"\"dur\":%.3f,\"pid\":%d,\"tid\":%d}", since, ts - since, vp,
+		tid);
+}
+
+long
+trace_export(const char *path)
+{
+	/* the thread running on each VP, and since when */
+	static int running[THREAD_MAX_VPS];
+	static double since[THREAD_MAX_VPS];
+	unsigned long end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	unsigned long i = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+	unsigned long seq;
+	double us_per_cycle, ts;
+	struct trace_event *e, copy;
+	long nr = 0;
+	int vp;
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (f == NULL)
+		return -1;
+	if (trace_enabled)
+		stop_tsc = __rdtsc();
+	us_per_cycle = (now_us() - start_us) / (__rdtsc() - start_tsc + 1);
+	for (vp = 0; vp < THREAD_MAX_VPS; vp++)
+		running[vp] = THREAD_INVALID;
+	/* name VP 0 first, so that the events can follow with a comma */
+	fprintf(f, "{\"traceEvents\":[\n");
+	trace_name(f, 0);
+	for (; i < end; i++) {
+		e = &ring[i & TRACE_MASK];
+		seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		copy = *e;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		/* skip an event that was overwritten while we copied it */
+		if (seq != i + 1 || __atomic_load_n(&e->seq, __ATOMIC_RELAXED)
+		    != seq)
+			continue;
+		ts = (copy.tsc - start_tsc) * us_per_cycle;
+		vp = copy.vp;
+		nr++;
+		if (copy.type == TRACE_RUN) {
+			trace_slice(f, vp, running[vp], since[vp], ts);
+			running[vp] = copy.tid;
+			since[vp] = ts;
+			continue;
+		}
+		fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+			"\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+			"\"args\":{\"arg\":%ld}}", trace_names[copy.type], ts, vp,
+			copy.tid, copy.arg);
+	}
+	/* the threads still running when tracing stopped */
+	ts = (stop_tsc - start_tsc) * us_per_cycle;
+	for (vp = 0; vp < THREAD_MAX_VPS; vp++) {
+		if (running[vp] == THREAD_INVALID)
+			continue;
+		trace_slice(f, vp, running[vp], since[vp], ts);
+		if (vp > 0) {
+			fprintf(f, ",\n");
+			trace_name(f, vp);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	if (fclose(f) != 0)
+		return -1;
+	return nr;
+}
@@ -0,0 +1,56 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/* A trace of scheduler events, kept in a ring buffer of the last TRACE_EVENTS
+ * of them, for looking at schedules in a trace viewer such as Perfetto or
+ * chrome://tracing. Recording an event takes no lock, so events can be
+ * recorded in the timer interrupt handler, and on any VP. While tracing is
+ * off, the cost of an event is one test of trace_enabled. */
+#define TRACE_EVENTS (1 << 16)
+
+enum trace_type {
+	TRACE_CREATE,		/* tid created thread arg */
+	TRACE_RUN,		/* tid started running, after thread arg */
+	TRACE_YIELD,		/* tid yielded to thread arg */
+	TRACE_PREEMPT,		/* tid was preempted, and yields next */
+	TRACE_SLEEP,		/* tid went to sleep, for arg usecs or -1 */
+	TRACE_WAKEUP,		/* tid was woken up by thread arg */
+	TRACE_LOCK_ACQUIRE,	/* tid acquired the lock at arg */
+	TRACE_LOCK_CONTEND,	/* tid waits for the lock at arg */
+	TRACE_LOCK_RELEASE,	/* tid released the lock at arg */
+	TRACE_EXIT,		/* tid exited, or was destroyed by thread arg */
+	TRACE_TYPES
+};
+
+struct trace_event {
+	unsigned long seq;	/* the number of the event, plus 1 */
+	unsigned long tsc;	/* when it happened */
+	long arg;
+	int tid;
+	short type;
+	short vp;		/* the VP it happened on */
+};
+
+extern int trace_enabled;
+
+/* record an event, if tracing is on. The arguments are only evaluated then. */
+#define TRACE(type, vp, tid, arg) do {					\
+		if (trace_enabled)					\
+			trace_record((type), (vp), (tid), (long)(arg));	\
+	} while (0)
+
+void trace_record(int type, int vp, int tid, long arg);
+
+/* start tracing, dropping the events recorded so far */
+void trace_start(void);
+/* stop tracing, keeping the events for trace_export */
+void trace_stop(void);
+
+/* write the events in the ring buffer to path, as a trace in the JSON format
+ * of chrome://tracing. Each VP is shown as a process, and the threads that ran
+ * on it as its threads, with a slice for each time a thread ran and an
+ * instant for each other event. Returns the number of events written, or -1
+ * with errno set if path cannot be written. */
+long trace_export(const char *path);
+
+#endif /* _TRACE_H_ */